@@ -0,0 +1,72 @@
+/* XRPMotor is a class used to drive the motor H-bridges directly from the PWM slices */
+
+#pragma once
+
+#include <Arduino.h>
+
+// PWM carrier frequency and duty resolution. These can be overridden via build_flags
+#ifndef XRP_MOTOR_PWM_FREQ_HZ
+#define XRP_MOTOR_PWM_FREQ_HZ 1000
+#endif
+
+#ifndef XRP_MOTOR_PWM_RESOLUTION_BITS
+#define XRP_MOTOR_PWM_RESOLUTION_BITS 12
+#endif
+
+class XRPMotor {
+    public:
+        // Must be called before any motor is initialized
+        static void configure(uint32_t freqHz, uint8_t resolutionBits);
+
+        // Start all configured slices together so that they share the same PWM period
+        static void startAll();
+
+        // Write the staged values of all the given motors so that they take
+        // effect in the same PWM period
+        static void applyAll(XRPMotor *motors, int count);
+
+        // Bitmask of the PWM slices used by the motors
+        static uint32_t getSliceMask();
+
+        boolean init(int in1, int in2);
+
+        // Stage a new value (-1 to 1), bypassing the slew limiter. Nothing is
+        // written to hardware until apply()
+        void setValue(double value);
+
+        // Maximum change in output per second (full scale is 1.0). 0 disables limiting
+        void setSlewRate(float ratePerSec);
+        float getSlewRate();
+
+        // Set the value the slew limiter should ramp towards
+        void setTarget(double value);
+
+        // Step the output towards the target. Returns true if the staged value changed
+        bool updateSlew(float dtSec);
+
+        double getTarget();
+        double getOutput();
+        bool isSlewLimiting();
+
+        // Write the staged value to the PWM compare registers. These are double
+        // buffered, so the new duty takes effect at the start of the next period.
+        // Use applyAll() to update several motors in the same period
+        void apply();
+
+    private:
+        static uint16_t _top;
+        static float _clkDiv;
+        static uint32_t _sliceMask;
+
+        void _initPwmPin(int pin);
+        void _stage(double value);
+
+        int _in1;
+        int _in2;
+        uint16_t _level;
+        bool _forward;
+
+        float _slewRate;
+        double _target;
+        double _output;
+};
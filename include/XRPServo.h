@@ -7,15 +7,39 @@
 // Servo pulses
 #define XRP_SERVO_MIN_PULSE_US 500
 #define XRP_SERVO_MAX_PULSE_US 2500
+#define XRP_SERVO_PERIOD_US 20000
 
 class XRPServo {
     public:
         boolean init(int pin);
-        void setValue(double value);
+
+        // Set the position as a -1 to 1 value
+        void setValue(double value, boolean immediate = false);
+
+        // Set the position as a pulse width in microseconds. Unless immediate is set,
+        // this goes through the rate limit (if enabled)
+        void setPulseWidth(int pulseUs, boolean immediate = false);
+
+        // Maximum change in pulse width per second. 0 disables limiting
+        void setRateLimit(float usPerSec);
+
+        // Step the output towards the target pulse width
+        void update(float dtSec);
+
+        int getPulseWidth();
         boolean isValid();
     private:
         boolean isValid(int pin);
+        boolean _initPwm(int pin);
+        void _write(int pulseUs);
+
+        static uint32_t _pwmSliceMask;
+
         int _pin;
-        int _value;
+        int _pulseUs;
+        int _targetUs;
+        float _outputUs;
+        float _rateLimit;
+        boolean _usePwm;
         Servo _servo;
-};
\ No newline at end of file
+};
@@ -0,0 +1,31 @@
+/* Free-running ADC sampler: round-robin conversions streamed by DMA into a ring buffer */
+
+#pragma once
+
+#include <Arduino.h>
+
+// Total conversions per second, shared across all sampled inputs
+#ifndef ADC_SAMPLER_RATE_HZ
+#define ADC_SAMPLER_RATE_HZ 20000
+#endif
+
+// Number of samples (per input) averaged into each reading
+#define ADC_SAMPLER_OVERSAMPLE 64
+
+namespace xrp {
+
+struct AdcReading {
+  float value;           // 0 to 1, or -1 if the pin isn't sampled
+  uint32_t timestampUs;  // micros() at the newest sample in the average
+  uint16_t samples;      // Number of samples in the average
+};
+
+// Start sampling the given ADC pins. Can only be called once
+bool adcSamplerInit(const uint8_t *pins, int numPins);
+bool adcSamplerIsRunning();
+
+// Average of the most recent samples for a pin. Only reads the ring buffer, so
+// this never waits on a conversion
+AdcReading adcSamplerRead(uint8_t pin);
+
+} // namespace xrp
@@ -0,0 +1,163 @@
+/* In-tree AHRS filters, tuned for the RP2040 (no FPU) and RP2350 (single precision FPU) */
+
+#pragma once
+
+#include <stdint.h>
+
+namespace xrp {
+
+/**
+ * Common interface for the orientation filters.
+ *
+ * Orientation is held as a quaternion. Euler angles use the same conventions as
+ * the Arduino Madgwick library (yaw is reported as 0-360), and are computed per
+ * axis only when they are asked for.
+ */
+class OrientationFilter {
+  public:
+    OrientationFilter();
+    virtual ~OrientationFilter() {}
+
+    virtual const char* name() const = 0;
+
+    void begin(float sampleFrequency);
+
+    // Return to the identity orientation
+    virtual void reset();
+
+    // Gyro in deg/s, accel in any consistent unit
+    virtual void updateIMU(float gx, float gy, float gz, float ax, float ay, float az) = 0;
+
+    // Euler angles in degrees
+    virtual float getRoll();
+    virtual float getPitch();
+    virtual float getYaw();
+
+    virtual void getQuaternion(float q[4]);
+
+  protected:
+    // Called whenever the sample rate changes, to refold per-update constants
+    virtual void _updateScales() {}
+
+    void _normalizeAndStore(float q0, float q1, float q2, float q3);
+
+    float _q0, _q1, _q2, _q3;
+    float _invSampleFreq;
+
+    // Cached Euler angles, with one dirty bit per axis
+    float _roll, _pitch, _yaw;
+    uint8_t _anglesDirty;
+};
+
+/**
+ * 6-DOF Madgwick filter.
+ *
+ * Same algorithm as the Arduino Madgwick library, but with the per-update
+ * constants (deg->rad, dt, beta) folded together in begin()
+ */
+class MadgwickFilter : public OrientationFilter {
+  public:
+    MadgwickFilter();
+
+    const char* name() const override { return "madgwick"; }
+
+    void setBeta(float beta);
+    void updateIMU(float gx, float gy, float gz, float ax, float ay, float az) override;
+
+  protected:
+    void _updateScales() override;
+
+  private:
+    float _beta;
+    float _gyroScale;
+    float _betaDt;
+};
+
+/**
+ * 6-DOF Madgwick filter in Q30 fixed point.
+ *
+ * Same algorithm as MadgwickFilter, with all of the per-update math done in
+ * 32/64 bit integers. The RP2040 has no FPU, so this avoids the soft float
+ * calls apart from converting the six inputs. The float quaternion (and the
+ * Euler angles) is only produced when it is read
+ */
+class MadgwickFixedFilter : public OrientationFilter {
+  public:
+    MadgwickFixedFilter();
+
+    const char* name() const override { return "madgwick_fixed"; }
+
+    void setBeta(float beta);
+    void reset() override;
+    void updateIMU(float gx, float gy, float gz, float ax, float ay, float az) override;
+
+    float getRoll() override;
+    float getPitch() override;
+    float getYaw() override;
+    void getQuaternion(float q[4]) override;
+
+  protected:
+    void _updateScales() override;
+
+  private:
+    void _syncQuaternion();
+
+    float _beta;
+    float _gyroScaleQ30;
+    int32_t _betaDtQ30;
+
+    // Q30 quaternion, copied into the float one on read
+    int32_t _fq0, _fq1, _fq2, _fq3;
+    bool _floatDirty;
+};
+
+/**
+ * 6-DOF Mahony filter (PI correction of the gyro from the gravity vector).
+ *
+ * Cheaper than Madgwick per update: one normalization of the accel, no
+ * gradient to normalize
+ */
+class MahonyFilter : public OrientationFilter {
+  public:
+    MahonyFilter();
+
+    const char* name() const override { return "mahony"; }
+
+    void setGains(float kp, float ki);
+    void reset() override;
+    void updateIMU(float gx, float gy, float gz, float ax, float ay, float az) override;
+
+  protected:
+    void _updateScales() override;
+
+  private:
+    float _twoKp;
+    float _twoKi;
+    float _integralFB[3];
+    float _halfDt;
+};
+
+/**
+ * Yaw-only filter for flat ground driving. Integrates the Z gyro and nothing
+ * else, so roll and pitch always read 0
+ */
+class YawOnlyFilter : public OrientationFilter {
+  public:
+    YawOnlyFilter();
+
+    const char* name() const override { return "yaw"; }
+
+    void reset() override;
+    void updateIMU(float gx, float gy, float gz, float ax, float ay, float az) override;
+
+    float getRoll() override;
+    float getPitch() override;
+    float getYaw() override;
+    void getQuaternion(float q[4]) override;
+
+  private:
+    // Heading in degrees, kept in [0, 360) to match the quaternion filters
+    float _yawDeg;
+};
+
+} // namespace xrp
@@ -1,6 +1,8 @@
 #pragma once
 
 #include <stdint.h>
+#include <string.h>
+
 /**
  * Decode a float from a 4-byte buffer in Network Byte order
  */
@@ -49,4 +51,116 @@ void int32ToNetwork(int32_t num, char* buf, int offset = 0);
 /**
  * Encode a UInt32 to a buffer in Network Byte Order
 */
-void uint32ToNetwork(uint32_t num, char* buf, int offset = 0);
\ No newline at end of file
+void uint32ToNetwork(uint32_t num, char* buf, int offset = 0);
+
+/**
+ * Encode a UInt32 as a varint: 7 bits per byte, least significant group first,
+ * with the top bit set on every byte but the last. Returns the bytes written (1-5)
+*/
+int varintToNetwork(uint32_t num, char* buf, int offset = 0);
+
+/**
+ * Encode an Int32 as a zigzag varint, so that small negative values stay short.
+ * Returns the bytes written (1-5)
+*/
+int zigzagVarintToNetwork(int32_t num, char* buf, int offset = 0);
+
+/**
+ * Convert a float to an int16 in units of 1/scale, rounded to nearest and
+ * saturated at the int16 range
+*/
+int16_t floatToFixedPoint(float value, float scale);
+
+
+// ==================================================
+// Wire codec
+// ==================================================
+
+// NOTE: The RP2040/RP2350 are Little Endian, and Network Byte Order is Big Endian
+static_assert(__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__, "byteutils assumes a little endian target");
+
+// Single values. memcpy keeps unaligned buffer access legal, and compiles to
+// byte loads/stores on the M0+
+inline void toNetwork(uint8_t v, char* buf, int offset) { buf[offset] = v; }
+inline void toNetwork(uint16_t v, char* buf, int offset) { v = __builtin_bswap16(v); memcpy(buf + offset, &v, 2); }
+inline void toNetwork(uint32_t v, char* buf, int offset) { v = __builtin_bswap32(v); memcpy(buf + offset, &v, 4); }
+inline void toNetwork(int16_t v, char* buf, int offset) { toNetwork(__builtin_bit_cast(uint16_t, v), buf, offset); }
+inline void toNetwork(int32_t v, char* buf, int offset) { toNetwork(__builtin_bit_cast(uint32_t, v), buf, offset); }
+inline void toNetwork(float v, char* buf, int offset) { toNetwork(__builtin_bit_cast(uint32_t, v), buf, offset); }
+
+inline void fromNetwork(const char* buf, int offset, uint8_t &v) { v = buf[offset]; }
+inline void fromNetwork(const char* buf, int offset, uint16_t &v) { memcpy(&v, buf + offset, 2); v = __builtin_bswap16(v); }
+inline void fromNetwork(const char* buf, int offset, uint32_t &v) { memcpy(&v, buf + offset, 4); v = __builtin_bswap32(v); }
+inline void fromNetwork(const char* buf, int offset, int16_t &v) { uint16_t u; fromNetwork(buf, offset, u); v = __builtin_bit_cast(int16_t, u); }
+inline void fromNetwork(const char* buf, int offset, int32_t &v) { uint32_t u; fromNetwork(buf, offset, u); v = __builtin_bit_cast(int32_t, u); }
+inline void fromNetwork(const char* buf, int offset, float &v) { uint32_t u; fromNetwork(buf, offset, u); v = __builtin_bit_cast(float, u); }
+
+// Runs of values of the same type
+template <typename T>
+inline void toNetwork(const T* values, int count, char* buf, int offset) {
+  for (int i = 0; i < count; i++) {
+    toNetwork(values[i], buf, offset + i * (int)sizeof(T));
+  }
+}
+
+template <typename T>
+inline void fromNetwork(const char* buf, int offset, T* values, int count) {
+  for (int i = 0; i < count; i++) {
+    fromNetwork(buf, offset + i * (int)sizeof(T), values[i]);
+  }
+}
+
+// Field of N values of the same type, passed to and from the codec as a pointer
+template <typename T, int N>
+struct WireArray {};
+
+template <typename T>
+struct WireField {
+  typedef T Arg;
+  typedef T& OutArg;
+  static constexpr int size = sizeof(T);
+  static void put(char* buf, int offset, Arg v) { toNetwork(v, buf, offset); }
+  static void get(const char* buf, int offset, OutArg v) { fromNetwork(buf, offset, v); }
+};
+
+template <typename T, int N>
+struct WireField<WireArray<T, N>> {
+  typedef const T* Arg;
+  typedef T* OutArg;
+  static constexpr int size = N * sizeof(T);
+  static void put(char* buf, int offset, Arg v) { toNetwork(v, N, buf, offset); }
+  static void get(const char* buf, int offset, OutArg v) { fromNetwork(buf, offset, v, N); }
+};
+
+/**
+ * Layout of a fixed size tagged message: [size(1)] [tag(1)] [fields...]
+ * Sizes are compile time constants, and the encoder and decoder share one
+ * definition of the field order
+*/
+template <uint8_t Tag, typename... Fields>
+struct WireMessage {
+  static constexpr uint8_t tag = Tag;
+
+  // Tag and fields, which is what the size byte holds
+  static constexpr int payloadSize = 1 + (WireField<Fields>::size + ... + 0);
+
+  // Including the size byte
+  static constexpr int size = payloadSize + 1;
+
+  static_assert(payloadSize <= 255, "Message too long for its size byte");
+
+  // Returns the bytes written (size)
+  static int encode(char* buf, int offset, typename WireField<Fields>::Arg... values) {
+    buf[offset] = payloadSize;
+    buf[offset+1] = Tag;
+    int pos = offset + 2;
+    ((WireField<Fields>::put(buf, pos, values), pos += WireField<Fields>::size), ...);
+    return size;
+  }
+
+  // start is the index of the tag, as in the tagged data handlers
+  static void decode(const char* buf, int start, typename WireField<Fields>::OutArg... values) {
+    int pos = start + 1;
+    ((WireField<Fields>::get(buf, pos, values), pos += WireField<Fields>::size), ...);
+  }
+};
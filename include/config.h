@@ -14,11 +14,41 @@ class XRPNetConfig {
     std::string defaultAPName {""};
     std::string defaultAPPassword {""};
     std::vector< std::pair<std::string, std::string> > networkList;
+
+    // Largest outbound UDP datagram. Bigger telemetry frames are split
+    int mtu {512};
+};
+
+class XRPMotorConfig {
+  public:
+    // Max change in motor output per second, per motor. 0 disables limiting
+    std::vector<float> slewRates {0, 0, 0, 0};
+};
+
+class XRPServoConfig {
+  public:
+    // Max change in servo pulse width (in us) per second, per servo. 0 disables limiting
+    std::vector<float> rateLimits {0, 0, 0, 0};
+};
+
+class XRPImuConfig {
+  public:
+    // Sensor ODR, which is also the AHRS update rate
+    int sampleRateHz {208};
+
+    // Orientation filter: madgwick, mahony or yaw
+    std::string filter {"madgwick"};
+
+    // Orientation telemetry: euler (legacy gyro tag), quaternion or both
+    std::string orientation {"euler"};
 };
 
 class XRPConfiguration {
   public:
     XRPNetConfig networkConfig;
+    XRPMotorConfig motorConfig;
+    XRPServoConfig servoConfig;
+    XRPImuConfig imuConfig;
 
     std::string toJsonString();
 };
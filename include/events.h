@@ -0,0 +1,41 @@
+/* Edge and threshold events that the host subscribes to. Changes are reported
+   in their own packet as soon as they are seen, rather than with the next data frame */
+
+#pragma once
+
+#include <Arduino.h>
+
+// Minimum time between two changes of the same event. Debounces the button and
+// bounds the packet rate if a sensor sits right on its threshold
+#define EVENT_MIN_INTERVAL_US 5000
+
+namespace xrp {
+
+enum class RobotEvent : uint8_t {
+  BUTTON = 0,  // User button pressed/released. No threshold
+  LINE_LEFT,   // Left reflectance above threshold (V)
+  LINE_RIGHT,  // Right reflectance above threshold (V)
+  RANGE_NEAR,  // Rangefinder below threshold (V)
+  COLLISION,   // Accel magnitude more than threshold (g) away from 1g
+  COUNT
+};
+
+struct EventState {
+  bool active;
+  uint32_t timeUs; // micros() at the last change
+  float value;     // Reading that caused the last change
+};
+
+// Returns false if the event doesn't exist
+bool eventsSubscribe(uint8_t event, bool enabled, float threshold);
+
+// Back to the default subscriptions (button only)
+void eventsReset();
+
+// Check every subscribed event. Returns a mask of (1 << event) for each one
+// that changed state. Cheap enough to call every loop
+uint32_t eventsPoll();
+
+EventState eventsGetState(RobotEvent event);
+
+} // namespace xrp
@@ -0,0 +1,108 @@
+/* Builds outbound datagrams from tagged messages. Each message is checked
+   against its largest encoded size, and a new datagram is started when the next
+   one won't fit in the MTU */
+
+#pragma once
+
+#include <stdint.h>
+
+#include "wpilibudp.h"
+
+// [seq(2)] [ctrl(1)] at the start of every datagram
+#define FRAME_HEADER_SIZE 3
+
+// Fits in one 1500 byte Ethernet/WiFi frame after the IP and UDP headers
+#define FRAME_MAX_MTU 1472
+#define FRAME_MIN_MTU 128
+#define FRAME_DEFAULT_MTU 512
+
+namespace wpilibudp {
+
+class FrameBuilder {
+  public:
+    // Called with each finished datagram
+    typedef void (*SendCallback)(const char* data, int len);
+
+    FrameBuilder(SendCallback send, uint16_t &seq) :
+        _send(send),
+        _seq(seq) {}
+
+    // Clamped to [FRAME_MIN_MTU, FRAME_MAX_MTU]. Takes effect from the next datagram
+    void setMtu(int mtu);
+    int getMtu() const { return _mtu; }
+
+    // Sends the buffered messages, if there are any. Must be called once the
+    // frame is complete
+    void flush();
+
+    // Space left for messages in the current datagram
+    int remaining() const;
+
+    // Messages dropped because they came out larger than their size table entry
+    uint32_t getDroppedCount() const { return _dropped; }
+
+    void addDeviceTime(uint32_t timeUs);
+    void addDescriptor(const char* firmwareVersion, int firmwareVersionLen);
+    void addEncoder(int deviceId, int count, unsigned period, unsigned divisor);
+    void addDIO(int deviceId, bool value);
+    void addGyro(float rates[3], float angles[3]);
+    void addQuaternion(float quat[4], float rates[3]);
+    void addAccel(float accels[3]);
+    void addImuHealth(uint8_t state, uint16_t errorCount, uint16_t recoveryCount);
+    void addAnalog(int deviceId, float voltage, uint16_t ageMs, bool valid);
+    void addMotorState(int deviceId, float target, float output);
+    void addEvent(uint8_t event, bool active, uint32_t timeUs, float value);
+
+    // Answers to pending history queries, in whatever space is left in the
+    // current datagram. The rest carry over to the next frame
+    void addHistoryResponses();
+
+  private:
+    // Every message has to fit in an empty datagram at the smallest MTU, so
+    // splitting is always enough to make room. Returns where the message was
+    // written, or -1 if it was dropped
+    template <int MaxSize, typename Writer>
+    int _append(Writer write) {
+      static_assert(MaxSize <= FRAME_MIN_MTU - FRAME_HEADER_SIZE, "Message can't fit in a datagram");
+
+      if (_len + MaxSize > _mtu) {
+        flush();
+      }
+      if (_len == 0) {
+        _startDatagram();
+      }
+
+      // The variable length writers (descriptor, compact encoder) can come out
+      // at any size, so check what was actually written before keeping it.
+      // Dropped rather than asserted: a panic would leave the motors running
+      // at their last duty
+      _encoderRun = -1;
+      int start = _len;
+      int written = write(_buffer, start);
+      if (written <= 0 || written > MaxSize) {
+        _dropped++;
+        return -1;
+      }
+      _len += written;
+      return start;
+    }
+
+    void _startDatagram();
+
+    // No message can be longer than 256 bytes (its size byte plus up to 255),
+    // so a message that overruns its size table entry stays inside the buffer
+    // until it is dropped
+    char _buffer[FRAME_MAX_MTU + 256];
+    int _len = 0;
+    int _mtu = FRAME_DEFAULT_MTU;
+    uint32_t _dropped = 0;
+
+    // Compact encoder message that the next encoder can be folded into, -1 if
+    // the last message was anything else
+    int _encoderRun = -1;
+
+    SendCallback _send;
+    uint16_t &_seq;
+};
+
+} // namespace wpilibudp
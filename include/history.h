@@ -0,0 +1,69 @@
+/* Fixed-size, timestamped sample history for each sensor, for time-indexed queries from the host */
+
+#pragma once
+
+#include <stdint.h>
+
+// Samples kept per sensor. Producers record at most once per record period, so
+// this is at least ~1.3s of history
+#define HISTORY_LENGTH 128
+#define HISTORY_MAX_FIELDS 3
+#define HISTORY_RECORD_PERIOD_US 10000
+
+namespace xrp {
+
+enum class HistorySensor : uint8_t {
+  ENCODER_0 = 0,  // count, period
+  ENCODER_1,
+  ENCODER_2,
+  ENCODER_3,
+  GYRO_RATE,      // x, y, z (deg/s)
+  GYRO_ANGLE,     // roll, pitch, yaw (deg)
+  ACCEL,          // x, y, z (g)
+  ANALOG_0,       // voltage
+  ANALOG_1,
+  ANALOG_2,
+  COUNT
+};
+
+// Flags describing how a queried sample was produced
+#define HISTORY_FLAG_EXACT 0x01        // Recorded at exactly the requested time
+#define HISTORY_FLAG_INTERPOLATED 0x02 // Interpolated between two recorded samples
+#define HISTORY_FLAG_CLAMPED 0x04      // Requested time is outside the history; nearest sample returned
+
+// Most fields are floats. The encoder period is kept as the raw uint32 from
+// readEncoderOriented() (direction in bit 0, UINT32_MAX when stopped), which a
+// float can't hold exactly. Either way it goes on the wire as the same 4 bytes
+union HistoryValue {
+  float f;
+  uint32_t u;
+};
+
+struct HistorySample {
+  uint32_t timeUs;
+  HistoryValue values[HISTORY_MAX_FIELDS];
+};
+
+// Number of fields recorded for a sensor, or 0 if it isn't a valid sensor
+int historyFieldCount(uint8_t sensor);
+
+// Record a sample at the time it was measured. Samples that aren't newer than
+// the last one recorded (i.e. the same sample again) are dropped
+void historyRecord(HistorySensor sensor, uint32_t timeUs, const HistoryValue *values);
+
+// Same, for sensors whose fields are all floats
+void historyRecord(HistorySensor sensor, uint32_t timeUs, const float *values);
+
+// True if a record period has passed since the last sample recorded for sensor
+bool historyRecordDue(HistorySensor sensor, uint32_t timeUs);
+
+// Value at the given time. Returns false if nothing has been recorded yet
+bool historyQueryAt(uint8_t sensor, uint32_t timeUs, HistorySample &out, uint8_t &flags);
+
+// Recorded samples in [startUs, endUs], oldest first. To page through a window,
+// pass the time of the last sample sent as startUs with startExclusive set.
+// Returns the number written to out
+int historyQueryWindow(uint8_t sensor, uint32_t startUs, uint32_t endUs,
+                       HistorySample *out, int maxSamples, bool startExclusive = false);
+
+} // namespace xrp
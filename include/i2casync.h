@@ -0,0 +1,32 @@
+/* Non-blocking I2C register reads, driven by DMA on the I2C block that a TwoWire instance owns */
+
+#pragma once
+
+#include <Wire.h>
+
+// Largest single read, in bytes
+#define I2C_ASYNC_MAX_READ_LEN 512
+
+namespace xrp {
+
+// Called from the DMA interrupt (or from i2cAsyncPoll() on failure), so keep it short
+typedef void (*I2cAsyncCallback)(bool success, void *context);
+
+// Claim the DMA channels. The bus must already be set up through the TwoWire instance
+bool i2cAsyncInit(TwoWire *wire);
+
+// Start a register read. Returns false if a transfer is already in flight
+bool i2cAsyncReadRegisters(uint8_t addr, uint8_t reg, uint8_t *buffer, size_t len,
+                           I2cAsyncCallback callback, void *context);
+
+bool i2cAsyncBusy();
+
+// Wait for the current transfer to finish, so that the bus can be used through
+// TwoWire again. Returns false on timeout
+bool i2cAsyncWait(unsigned long timeoutUs);
+
+// Checks for aborted (NAK'd) or stuck transfers and completes them with an
+// error. Call this regularly from the main loop
+void i2cAsyncPoll();
+
+} // namespace xrp
@@ -8,14 +8,63 @@
 
 namespace xrp {
 
+struct ImuStats {
+  const char *filterName;    // Active orientation filter
+  int sampleRateHz;          // Configured sensor/AHRS rate
+  float updateRateHz;        // Measured AHRS updates per second
+  unsigned long avgUpdateCycles; // Average CPU cycles for a single AHRS update
+  unsigned long avgUpdateUs; // Average time for a single AHRS update
+  unsigned long avgDrainUs;  // Average time to drain the FIFO, including AHRS updates
+  float cpuLoadPct;          // Share of core0 time spent in the IMU
+};
+
+// Per-update cost of one orientation filter, from the replay at boot
+struct ImuFilterCost {
+  const char *name;
+  unsigned long updateCycles;
+};
+
+#define IMU_FILTER_COUNT 4
+
+enum class ImuHealth : uint8_t {
+  OK = 0,         // Reads are succeeding and samples are arriving
+  DEGRADED = 1,   // Recent bus errors, but still getting samples
+  RECOVERING = 2, // Clearing the bus and re-initializing the sensor
+  OFFLINE = 3     // Not detected at boot
+};
+
+struct ImuHealthInfo {
+  ImuHealth state;
+  unsigned int errorCount;    // Failed bus transactions since boot
+  unsigned int recoveryCount; // Recovery attempts since boot
+};
+
 bool imuIsReady();
 
 void imuSetEnabled(bool enabled);
 bool imuIsEnabled();
 
+bool imuSetSampleRate(int hz);
+
+// Select the orientation filter by name: "madgwick", "madgwick_fixed", "mahony" or "yaw"
+bool imuSetFilter(const char *name);
+
 void imuInit(uint8_t addr, TwoWire *theWire);
+// Runs a full calibration. The result is written by imuSaveCalibration()
 void imuCalibrate(unsigned long calibrationTime);
 
+// Read the saved calibration from flash. Call from core0 before
+// imuLoadCalibration()
+bool imuReadSavedCalibration();
+
+// Restore the saved calibration, after a short check that it still applies.
+// Returns false if a full calibration is needed
+bool imuLoadCalibration();
+
+// Write a new calibration from imuCalibrate() to flash, if there is one. Call
+// from core0
+void imuSaveCalibration();
+
 void imuPeriodic();
 bool imuDataReady();
 
@@ -31,10 +80,23 @@ float imuGetRoll();
 float imuGetPitch();
 float imuGetYaw();
 
+// Raw filter orientation as w, x, y, z. Angle resets are not applied
+void imuGetQuaternion(float q[4]);
+
 void imuResetRoll();
 void imuResetPitch();
 void imuResetYaw();
 
+ImuStats imuGetStats();
+
+// Every filter timed on the same fixed replay at boot, so they can be compared
+// on this board. Returns the number of filters
+int imuGetFilterCosts(ImuFilterCost costs[IMU_FILTER_COUNT]);
+ImuHealthInfo imuGetHealth();
+
+void imuSetMotionHint(bool moving);
+unsigned int imuGetGyroBias(float bias[3]);
+
 void gyroReset();
 
 } // namespace xrp
\ No newline at end of file
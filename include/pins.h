@@ -7,6 +7,12 @@
 // Ultra Sonic max pulse
 #define ULTRASONIC_MAX_PULSE_WIDTH 23200
 
+// I2C bus clock for the IMU. The LSM6DSOX supports fast mode plus (1 MHz), but
+// 400 kHz leaves margin for the board pull-ups. Override via build_flags
+#ifndef XRP_I2C_CLOCK_HZ
+#define XRP_I2C_CLOCK_HZ 400000
+#endif
+
 // LED_BUILTIN is defined in the board to 
 // the correct pin 
 #define XRP_BUILTIN_LED LED_BUILTIN
@@ -37,6 +43,7 @@
 #define ENC_SM_IDX_MOTOR_3 2
 #define ENC_SM_IDX_MOTOR_4 3
 
+#define NUM_OF_MOTORS 4
 #define NUM_OF_ENCODERS 4
 #define NUM_OF_SERVOS 4
 
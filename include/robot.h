@@ -6,20 +6,48 @@
 
 namespace xrp {
 
+// WATCHDOG_LOST is entered when the host stops sending packets, and cleared by
+// the next packet. It does not latch
+enum class RobotState { DISABLED, ENABLED, WATCHDOG_LOST };
+
+struct AnalogReading {
+  float voltage;  // 0 to 5V, or -1 if the sensor isn't initialized
+  uint16_t ageMs; // Time since the newest sample that went into the value
+  bool valid;     // False if the sensor has stopped returning usable data
+};
+
 void robotInit();
 bool robotInitialized();
 uint8_t robotPeriodic();
 
 // Robot control
 void robotSetEnabled(bool enabled);
+RobotState robotGetState();
+bool robotIsMoving();
 
 // Encoder Related
 void configureEncoder(int deviceId, int chA, int chB);
 int readEncoderRaw(int rawDeviceId);
 uint readEncoderPeriod(int rawDeviceId);
 
+// Count and period as the host sees them. The left encoder is flipped so that
+// both sides count up when driving forward
+void readEncoderOriented(int rawDeviceId, int &count, uint &period);
+
 // PWM Related
 void setPwmValue(int wpilibChannel, double value);
+void commitPwmValues();
+
+// Motor slew limiting
+void setMotorSlewRate(int motorIdx, float ratePerSec);
+float getMotorSlewRate(int motorIdx);
+double getMotorTarget(int motorIdx);
+double getMotorOutput(int motorIdx);
+
+// Servo Related
+void setServoPulseWidth(int wpilibChannel, int pulseUs);
+void setServoRateLimit(int servoIdx, float usPerSec);
+int getServoCount(); // Servos that have a pin on this board
 
 // DIO Related
 bool isUserButtonPressed();
@@ -30,12 +58,14 @@ void reflectanceInit();
 bool reflectanceInitialized();
 float getReflectanceLeft5V();
 float getReflectanceRight5V();
+AnalogReading getReflectanceLeft();
+AnalogReading getReflectanceRight();
 
 // Rangefinder
 void rangefinderInit();
 bool rangefinderInitialized();
 float getRangefinderDistance5V();
-void rangefinderPollForData();
+AnalogReading getRangefinder();
 void rangefinderPeriodic();
 
 } // namespace xrp
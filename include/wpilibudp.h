@@ -1,5 +1,7 @@
 #pragma once
 
+#include "byteutils.h"
+
 #define XRP_TAG_MOTOR 0x12
 #define XRP_TAG_SERVO 0x13
 #define XRP_TAG_DIO 0x14
@@ -7,17 +9,166 @@
 #define XRP_TAG_GYRO 0x16
 #define XRP_TAG_ACCEL 0x17
 #define XRP_TAG_ENCODER 0x18
+#define XRP_TAG_MOTOR_STATE 0x19
+#define XRP_TAG_SERVO_PULSE 0x1A
+#define XRP_TAG_IMU_HEALTH 0x1B
+#define XRP_TAG_QUATERNION 0x1C
+#define XRP_TAG_HISTORY_QUERY 0x1D
+#define XRP_TAG_HISTORY_SAMPLE 0x1E
+#define XRP_TAG_DEVICE_TIME 0x1F
+#define XRP_TAG_EVENT_SUBSCRIBE 0x20
+#define XRP_TAG_EVENT 0x21
+#define XRP_TAG_TELEMETRY_SUBSCRIBE 0x22
+#define XRP_TAG_HELLO 0x23
+#define XRP_TAG_DESCRIPTOR 0x24
+
+// Protocol version this firmware speaks. Hosts that never send a hello get
+// version 1, the original protocol
+#define XRP_PROTOCOL_VERSION 2
+
+// Capability bits in the descriptor
+#define XRP_CAP_REFLECTANCE 0x0001
+#define XRP_CAP_RANGEFINDER 0x0002
+#define XRP_CAP_QUATERNION 0x0004
+#define XRP_CAP_HISTORY 0x0008
+#define XRP_CAP_EVENTS 0x0010
+#define XRP_CAP_SUBSCRIPTIONS 0x0020
+#define XRP_CAP_COMPACT 0x0040
+
+// Hello options
+#define XRP_HELLO_OPT_COMPACT 0x01 // Fixed point/varint payloads (protocol version 2+)
+
+// Largest encoded size of each outbound message, including the size byte.
+// Fixed layouts come from the wire schema below
+#define XRP_MSG_SIZE_ENCODER (wpilibudp::EncoderMessage::size)
+#define XRP_MSG_SIZE_DIO (wpilibudp::DioMessage::size)
+#define XRP_MSG_SIZE_GYRO (wpilibudp::GyroMessage::size)
+#define XRP_MSG_SIZE_ACCEL (wpilibudp::AccelMessage::size)
+#define XRP_MSG_SIZE_ANALOG (wpilibudp::AnalogMessage::size)
+#define XRP_MSG_SIZE_MOTOR_STATE (wpilibudp::MotorStateMessage::size)
+#define XRP_MSG_SIZE_IMU_HEALTH 9 // Compact layout, both counts at 3 byte varints
+#define XRP_MSG_SIZE_QUATERNION (wpilibudp::QuaternionMessage::size)
+#define XRP_MSG_SIZE_DEVICE_TIME (wpilibudp::DeviceTimeMessage::size)
+#define XRP_MSG_SIZE_EVENT (wpilibudp::EventMessage::size)
+#define XRP_MSG_SIZE_DESCRIPTOR 77
+#define XRP_MSG_SIZE_HISTORY_SAMPLE 20
+
+// History query modes
+#define XRP_HISTORY_MODE_AT 0
+#define XRP_HISTORY_MODE_WINDOW 1
+
+// Analog tag flags
+#define XRP_ANALOG_FLAG_VALID 0x01
+
+// Fixed point scales for the compact tags
+#define QUATERNION_FIXED_SCALE 16384.0f
+#define GYRO_RATE_FIXED_SCALE 16.0f
+#define ANGLE_FIXED_SCALE 50.0f     // +-655 deg, covers yaw in [0, 360)
+#define ACCEL_FIXED_SCALE 2048.0f   // +-16 g, the full IMU range
+#define VOLTAGE_FIXED_SCALE 6000.0f // +-5.46 V
+#define MOTOR_FIXED_SCALE 32767.0f  // Motor values are -1 to 1
+
+// Fastest rate a telemetry subscription can ask for
+#define XRP_TELEMETRY_MIN_PERIOD_MS 10
 
 namespace wpilibudp {
 
+// ==================================================
+// Wire schema for the fixed size messages. The encoders and the tagged data
+// handlers both use these, so a layout is only written down once
+// ==================================================
+
+// Host to XRP
+typedef WireMessage<XRP_TAG_MOTOR, uint8_t, float> MotorMessage;                  // channel, value (-1 to 1)
+typedef WireMessage<XRP_TAG_SERVO, uint8_t, float> ServoMessage;                  // channel, position (0 to 1)
+typedef WireMessage<XRP_TAG_SERVO_PULSE, uint8_t, uint16_t> ServoPulseMessage;    // channel, pulse (us)
+typedef WireMessage<XRP_TAG_HISTORY_QUERY, uint8_t, uint8_t, uint32_t> HistoryQueryMessage; // sensor, mode, start (us)
+typedef WireMessage<XRP_TAG_HISTORY_QUERY, uint8_t, uint8_t, uint32_t, uint32_t> HistoryWindowQueryMessage; // ..., end (us)
+typedef WireMessage<XRP_TAG_EVENT_SUBSCRIBE, uint8_t, uint8_t, float> EventSubscribeMessage; // event, enabled, threshold
+typedef WireMessage<XRP_TAG_HELLO, uint8_t> HelloMessage;                         // version
+typedef WireMessage<XRP_TAG_HELLO, uint8_t, uint8_t> HelloOptionsMessage;         // version, options
+
+// Both directions
+typedef WireMessage<XRP_TAG_DIO, uint8_t, uint8_t> DioMessage;                    // channel, value
+
+// XRP to host
+typedef WireMessage<XRP_TAG_ENCODER, uint8_t, int32_t, uint32_t, uint32_t> EncoderMessage; // id, count, period, divisor
+typedef WireMessage<XRP_TAG_ENCODER, uint8_t, int32_t, uint32_t> EncoderV2Message;          // id, count, period
+typedef WireMessage<XRP_TAG_GYRO, WireArray<float, 3>, WireArray<float, 3>> GyroMessage;   // rates, angles
+typedef WireMessage<XRP_TAG_GYRO, WireArray<int16_t, 3>, WireArray<int16_t, 3>> CompactGyroMessage;
+typedef WireMessage<XRP_TAG_ACCEL, WireArray<float, 3>> AccelMessage;
+typedef WireMessage<XRP_TAG_ACCEL, WireArray<int16_t, 3>> CompactAccelMessage;
+typedef WireMessage<XRP_TAG_ANALOG, uint8_t, float, uint16_t, uint8_t> AnalogMessage;      // id, value, age, flags
+typedef WireMessage<XRP_TAG_ANALOG, uint8_t, int16_t, uint16_t, uint8_t> CompactAnalogMessage;
+typedef WireMessage<XRP_TAG_MOTOR_STATE, uint8_t, float, float, uint8_t> MotorStateMessage; // id, target, output, limiting
+typedef WireMessage<XRP_TAG_MOTOR_STATE, uint8_t, int16_t, int16_t, uint8_t> CompactMotorStateMessage;
+typedef WireMessage<XRP_TAG_QUATERNION, WireArray<int16_t, 4>, WireArray<int16_t, 3>> QuaternionMessage; // wxyz, rates
+typedef WireMessage<XRP_TAG_DEVICE_TIME, uint32_t> DeviceTimeMessage;                       // time (us)
+typedef WireMessage<XRP_TAG_EVENT, uint8_t, uint8_t, uint32_t, float> EventMessage;       // event, active, time, value
+typedef WireMessage<XRP_TAG_IMU_HEALTH, uint8_t, uint16_t, uint16_t> ImuHealthMessage;     // state, errors, recoveries
+
+// Devices the host can subscribe to with XRP_TAG_TELEMETRY_SUBSCRIBE
+enum class TelemetryDevice : uint8_t {
+  ENCODER_0 = 0,
+  ENCODER_1,
+  ENCODER_2,
+  ENCODER_3,
+  DIO,
+  GYRO,
+  QUATERNION,
+  ACCEL,
+  IMU_HEALTH,
+  ANALOG_0,
+  ANALOG_1,
+  ANALOG_2,
+  MOTOR_STATE,
+  COUNT
+};
+
 bool dsWatchdogActive();
 
 bool processPacket(char* buffer, int size);
 void resetState();
 
+// Protocol version agreed with the host in the hello, or 1 if there wasn't one
+uint8_t sessionVersion();
+
+// True if the host asked for compact payloads in the hello
+bool sessionCompact();
+
+// True if the host has sent a hello that hasn't been answered yet
+bool descriptorRequested();
+
+// True once the host has sent a subscription. Until then every device is sent
+// in every frame
+bool telemetrySubscribed();
+
+// True if a subscribed frame should go out now: a device is due, or history
+// answers are waiting
+bool telemetryFrameDue(unsigned long nowMs);
+
+// True if the device should go in the frame being built, and marks it as sent
+bool telemetryDue(TelemetryDevice device, unsigned long nowMs);
+
+// Answers the hello with the static device description. Clears the request
+int writeDescriptorData(const char* firmwareVersion, int firmwareVersionLen, char* buffer, int offset = 0);
+
+// From protocol version 2 the divisor is left out (it's in the descriptor).
+// The encoder, gyro, accel, analog, motor state and IMU health writers switch
+// to their compact layouts when sessionCompact() is set
 int writeEncoderData(int deviceId, int count, unsigned period, unsigned divisor, char* buffer, int offset = 0);
 int writeDIOData(int deviceId, bool value, char* buffer, int offset = 0);
 int writeGyroData(float rates[3], float angles[3], char* buffer, int offset = 0);
 int writeAccelData(float accels[3], char* buffer, int offset = 0);
-int writeAnalogData(int deviceId, float voltage, char* buffer, int offset = 0);
+int writeAnalogData(int deviceId, float voltage, uint16_t ageMs, bool valid, char* buffer, int offset = 0);
+int writeMotorStateData(int deviceId, float target, float output, char* buffer, int offset = 0);
+int writeQuaternionData(float quat[4], float rates[3], char* buffer, int offset = 0);
+int writeDeviceTimeData(uint32_t timeUs, char* buffer, int offset = 0);
+int writeEventData(uint8_t event, bool active, uint32_t timeUs, float value, char* buffer, int offset = 0);
+
+// Answers to pending history queries, limited to maxLen bytes. Queries that
+// don't fit carry over to the next call
+int writeHistoryResponses(char* buffer, int offset, int maxLen);
+
+int writeImuHealthData(uint8_t state, uint16_t errorCount, uint16_t recoveryCount, char* buffer, int offset = 0);
 } // namespace wpilibudp
\ No newline at end of file
@@ -0,0 +1,170 @@
+#include <hardware/clocks.h>
+#include <hardware/gpio.h>
+#include <hardware/pwm.h>
+#include <hardware/sync.h>
+#include "XRPMotor.h"
+
+uint16_t XRPMotor::_top = (1 << XRP_MOTOR_PWM_RESOLUTION_BITS) - 1;
+float XRPMotor::_clkDiv = 1.0f;
+uint32_t XRPMotor::_sliceMask = 0;
+
+void XRPMotor::configure(uint32_t freqHz, uint8_t resolutionBits) {
+  if (resolutionBits < 8) resolutionBits = 8;
+  if (resolutionBits > 15) resolutionBits = 15;
+
+  _top = (1UL << resolutionBits) - 1;
+
+  // Divider is an 8.4 fixed point value, so clamp to the valid range
+  _clkDiv = (float)clock_get_hz(clk_sys) / ((float)freqHz * (_top + 1));
+  if (_clkDiv < 1.0f) _clkDiv = 1.0f;
+  if (_clkDiv > 255.9375f) _clkDiv = 255.9375f;
+
+  Serial.printf("[MOTOR] PWM %u Hz, %u-bit (div %f)\n", freqHz, resolutionBits, _clkDiv);
+}
+
+void XRPMotor::startAll() {
+  // Enabling every slice with a single register write keeps the counters in phase
+  pwm_set_mask_enabled(pwm_hw->en | _sliceMask);
+}
+
+void XRPMotor::applyAll(XRPMotor *motors, int count) {
+  // The compare registers are written one slice at a time, so pause the motor
+  // slices while writing. Otherwise a period boundary could fall between two
+  // writes. They restart with one register write, so they stay in phase and the
+  // new values all latch on the next wrap. The period stretches by the few
+  // cycles this takes
+  uint32_t irqState = save_and_disable_interrupts();
+  uint32_t enabled = pwm_hw->en;
+  pwm_set_mask_enabled(enabled & ~_sliceMask);
+
+  for (int i = 0; i < count; i++) {
+    motors[i].apply();
+  }
+
+  pwm_set_mask_enabled(enabled);
+  restore_interrupts(irqState);
+}
+
+uint32_t XRPMotor::getSliceMask() {
+  return _sliceMask;
+}
+
+void XRPMotor::_initPwmPin(int pin) {
+  uint slice = pwm_gpio_to_slice_num(pin);
+
+  // Slices are shared between pin pairs, so only configure each one once
+  if (!(_sliceMask & (1 << slice))) {
+    pwm_config cfg = pwm_get_default_config();
+    pwm_config_set_clkdiv(&cfg, _clkDiv);
+    pwm_config_set_wrap(&cfg, _top);
+    pwm_init(slice, &cfg, false);
+    _sliceMask |= (1 << slice);
+  }
+
+  pwm_set_gpio_level(pin, 0);
+  gpio_set_function(pin, GPIO_FUNC_PWM);
+}
+
+// Initialize the motor pins
+boolean XRPMotor::init(int in1, int in2) {
+  _in1 = in1;
+  _in2 = in2;
+  _level = 0;
+  _forward = true;
+  _slewRate = 0;
+  _target = 0;
+  _output = 0;
+
+#ifdef PICO_RP2350
+  // IN/IN driver: both pins carry PWM
+  _initPwmPin(_in1);
+  _initPwmPin(_in2);
+#else
+  // PHASE/ENABLE driver: IN_1 is the direction pin and IN_2 carries PWM
+  gpio_init(_in1);
+  gpio_set_dir(_in1, GPIO_OUT);
+  gpio_put(_in1, 1);
+  _initPwmPin(_in2);
+#endif
+
+  return true;
+}
+
+void XRPMotor::_stage(double value) {
+  _output = value;
+  _forward = (value >= 0.0);
+
+  // A level of top + 1 keeps the output high for the full period
+  _level = (uint16_t)(fabs(value) * (_top + 1));
+}
+
+void XRPMotor::setValue(double value) {
+  if (value > 1.0) value = 1.0;
+  if (value < -1.0) value = -1.0;
+
+  _target = value;
+  _stage(value);
+}
+
+void XRPMotor::setSlewRate(float ratePerSec) {
+  _slewRate = ratePerSec > 0 ? ratePerSec : 0;
+}
+
+float XRPMotor::getSlewRate() {
+  return _slewRate;
+}
+
+void XRPMotor::setTarget(double value) {
+  if (_slewRate == 0) {
+    setValue(value);
+    return;
+  }
+
+  if (value > 1.0) value = 1.0;
+  if (value < -1.0) value = -1.0;
+  _target = value;
+}
+
+bool XRPMotor::updateSlew(float dtSec) {
+  if (_output == _target) return false;
+
+  double maxStep = _slewRate * dtSec;
+  double delta = _target - _output;
+
+  double next;
+  if (delta > maxStep) {
+    next = _output + maxStep;
+  }
+  else if (delta < -maxStep) {
+    next = _output - maxStep;
+  }
+  else {
+    next = _target;
+  }
+
+  _stage(next);
+  return true;
+}
+
+double XRPMotor::getTarget() {
+  return _target;
+}
+
+double XRPMotor::getOutput() {
+  return _output;
+}
+
+bool XRPMotor::isSlewLimiting() {
+  return _output != _target;
+}
+
+void XRPMotor::apply() {
+#ifdef PICO_RP2350
+  // Direction determines which pin should be the brake
+  pwm_set_gpio_level(_in1, _forward ? _level : 0);
+  pwm_set_gpio_level(_in2, _forward ? 0 : _level);
+#else
+  gpio_put(_in1, _forward);
+  pwm_set_gpio_level(_in2, _level);
+#endif
+}
@@ -1,11 +1,21 @@
 #include <Servo.h>
+#include <hardware/clocks.h>
+#include <hardware/gpio.h>
+#include <hardware/pwm.h>
 #include "XRPServo.h"
+#include "XRPMotor.h"
 #include "pins.h"
 
+uint32_t XRPServo::_pwmSliceMask = 0;
+
 // Initialize the servo values
 boolean XRPServo::init(int pin) {
     _pin = pin;
-    _value = 0;
+    _pulseUs = -1;
+    _targetUs = (XRP_SERVO_MIN_PULSE_US + XRP_SERVO_MAX_PULSE_US) / 2;
+    _outputUs = _targetUs;
+    _rateLimit = 0;
+    _usePwm = false;
     boolean success = true;
 
     // Only attach to a servo if it is valid.
@@ -15,6 +25,13 @@ boolean XRPServo::init(int pin) {
       return true;
     }
 
+    // Prefer a hardware PWM slice, and fall back to the PIO based Servo library
+    // if the slice is already running at the motor frequency
+    if (_initPwm(pin)) {
+      Serial.printf("[SERVO] Pin %d using PWM slice %u\n", pin, pwm_gpio_to_slice_num(pin));
+      return true;
+    }
+
     if(_servo.attach(pin, XRP_SERVO_MIN_PULSE_US, XRP_SERVO_MAX_PULSE_US) == -1) {
         Serial.println("[ERR] Failed to attach servo1");
         success = false;
@@ -22,17 +39,88 @@ boolean XRPServo::init(int pin) {
     return success;
 }
 
+boolean XRPServo::_initPwm(int pin) {
+  uint slice = pwm_gpio_to_slice_num(pin);
+
+  if (XRPMotor::getSliceMask() & (1 << slice)) {
+    return false;
+  }
+
+  // One counter tick per microsecond, wrapping at the servo period
+  if (!(_pwmSliceMask & (1 << slice))) {
+    pwm_config cfg = pwm_get_default_config();
+    pwm_config_set_clkdiv(&cfg, (float)clock_get_hz(clk_sys) / 1000000.0f);
+    pwm_config_set_wrap(&cfg, XRP_SERVO_PERIOD_US - 1);
+    pwm_init(slice, &cfg, true);
+    _pwmSliceMask |= (1 << slice);
+  }
+
+  // Hold the output low until the first position is written
+  pwm_set_gpio_level(pin, 0);
+  gpio_set_function(pin, GPIO_FUNC_PWM);
+  _usePwm = true;
+  return true;
+}
+
 // Set the new servo position
-void XRPServo::setValue(double value) {
-  int val = ((value + 1.0) / 2.0) * 180;
+void XRPServo::setValue(double value, boolean immediate) {
+  int pulseUs = XRP_SERVO_MIN_PULSE_US + ((value + 1.0) / 2.0) * (XRP_SERVO_MAX_PULSE_US - XRP_SERVO_MIN_PULSE_US);
+  setPulseWidth(pulseUs, immediate);
+}
 
-  if(val != _value) {
-    _value = val;
+void XRPServo::setPulseWidth(int pulseUs, boolean immediate) {
+  if (pulseUs < XRP_SERVO_MIN_PULSE_US) pulseUs = XRP_SERVO_MIN_PULSE_US;
+  if (pulseUs > XRP_SERVO_MAX_PULSE_US) pulseUs = XRP_SERVO_MAX_PULSE_US;
+
+  _targetUs = pulseUs;
+
+  // Without a rate limit (or before the first write) go straight to the target
+  if (immediate || _rateLimit == 0 || _pulseUs < 0) {
+    _outputUs = pulseUs;
+    _write(pulseUs);
   }
+}
 
-  if ( isValid() && _servo.attached() ) {
-    _servo.write(val);
+void XRPServo::setRateLimit(float usPerSec) {
+  _rateLimit = usPerSec > 0 ? usPerSec : 0;
+}
+
+void XRPServo::update(float dtSec) {
+  if (_rateLimit == 0 || _pulseUs == _targetUs) return;
+
+  float maxStep = _rateLimit * dtSec;
+  float delta = _targetUs - _outputUs;
+
+  if (delta > maxStep) {
+    _outputUs += maxStep;
+  }
+  else if (delta < -maxStep) {
+    _outputUs -= maxStep;
   }
+  else {
+    _outputUs = _targetUs;
+  }
+
+  _write((int)(_outputUs + 0.5f));
+}
+
+void XRPServo::_write(int pulseUs) {
+  // Skip redundant writes
+  if (pulseUs == _pulseUs) return;
+  _pulseUs = pulseUs;
+
+  if (!isValid()) return;
+
+  if (_usePwm) {
+    pwm_set_gpio_level(_pin, pulseUs);
+  }
+  else if (_servo.attached()) {
+    _servo.writeMicroseconds(pulseUs);
+  }
+}
+
+int XRPServo::getPulseWidth() {
+  return _pulseUs;
 }
 
 bool XRPServo::isValid(int pin) {
@@ -42,4 +130,4 @@ bool XRPServo::isValid(int pin) {
 // Check if a valid pin
 bool XRPServo::isValid() {
   return isValid(_pin);
-}
\ No newline at end of file
+}
@@ -0,0 +1,172 @@
+#include <hardware/adc.h>
+#include <hardware/dma.h>
+
+#include "adcsampler.h"
+
+#ifndef ADC_BASE_PIN
+#define ADC_BASE_PIN 26
+#endif
+
+#ifndef ADC_TEMPERATURE_CHANNEL_NUM
+#define ADC_TEMPERATURE_CHANNEL_NUM 4
+#endif
+
+// The ADC clock is fixed at 48 MHz, and a conversion takes at least 96 cycles
+#define ADC_SAMPLER_CLOCK_HZ 48000000
+
+// Ring of 12 bit samples. The DMA write address wraps within it, so it must be
+// aligned to its size
+#define ADC_SAMPLER_RING_BITS 11
+#define ADC_SAMPLER_RING_BYTES (1 << ADC_SAMPLER_RING_BITS)
+#define ADC_SAMPLER_RING_LEN (ADC_SAMPLER_RING_BYTES / sizeof(uint16_t))
+
+// Transfers per DMA trigger before the control channel re-arms the data channel.
+// A multiple of the ring length, so the slot of each sample never shifts
+#define ADC_SAMPLER_DMA_CHUNK (ADC_SAMPLER_RING_LEN * 64)
+
+#define ADC_SAMPLER_MAX_SLOTS 4
+
+namespace xrp {
+
+uint16_t _adcRing[ADC_SAMPLER_RING_LEN] __attribute__((aligned(ADC_SAMPLER_RING_BYTES)));
+
+bool _adcSamplerRunning = false;
+int _adcDataChannel = -1;
+int _adcControlChannel = -1;
+uint32_t _adcReloadCount = ADC_SAMPLER_DMA_CHUNK;
+
+// Pin for each round-robin slot, in conversion order. The temperature sensor
+// (only used as padding) is 0xFF
+uint8_t _adcSlotPins[ADC_SAMPLER_MAX_SLOTS];
+int _adcNumSlots = 0;
+uint32_t _adcSamplePeriodUs = 0;
+uint32_t _adcStartUs = 0;
+
+bool adcSamplerInit(const uint8_t *pins, int numPins) {
+  if (_adcSamplerRunning) return false;
+  if (numPins <= 0 || numPins > ADC_SAMPLER_MAX_SLOTS) return false;
+
+  // Round robin goes through the enabled inputs in ascending order
+  uint32_t inputMask = 0;
+  for (int i = 0; i < numPins; i++) {
+    int input = pins[i] - ADC_BASE_PIN;
+    if (input < 0 || input >= ADC_TEMPERATURE_CHANNEL_NUM) {
+      Serial.printf("[ADC] Pin %d is not an ADC pin\n", pins[i]);
+      return false;
+    }
+    inputMask |= (1 << input);
+  }
+
+  // The slot count has to divide the ring length. Pad 3 inputs out to 4 with
+  // the temperature sensor
+  bool padWithTemp = false;
+  if (numPins == 3) {
+    inputMask |= (1 << ADC_TEMPERATURE_CHANNEL_NUM);
+    padWithTemp = true;
+  }
+
+  _adcNumSlots = 0;
+  int firstInput = -1;
+  for (int input = 0; input <= ADC_TEMPERATURE_CHANNEL_NUM; input++) {
+    if (!(inputMask & (1 << input))) continue;
+    if (firstInput < 0) firstInput = input;
+    _adcSlotPins[_adcNumSlots++] = (input == ADC_TEMPERATURE_CHANNEL_NUM) ? 0xFF : input + ADC_BASE_PIN;
+  }
+
+  _adcDataChannel = dma_claim_unused_channel(false);
+  _adcControlChannel = dma_claim_unused_channel(false);
+  if (_adcDataChannel < 0 || _adcControlChannel < 0) {
+    Serial.println("[ADC] No free DMA channels");
+    if (_adcDataChannel >= 0) dma_channel_unclaim(_adcDataChannel);
+    if (_adcControlChannel >= 0) dma_channel_unclaim(_adcControlChannel);
+    return false;
+  }
+
+  adc_init();
+  for (int i = 0; i < numPins; i++) {
+    adc_gpio_init(pins[i]);
+  }
+  if (padWithTemp) {
+    adc_set_temp_sensor_enabled(true);
+  }
+  adc_select_input(firstInput);
+  adc_set_round_robin(inputMask);
+  adc_fifo_setup(true, true, 1, false, false);
+  adc_set_clkdiv((float)ADC_SAMPLER_CLOCK_HZ / ADC_SAMPLER_RATE_HZ - 1.0f);
+  adc_fifo_drain();
+
+  _adcSamplePeriodUs = 1000000 / ADC_SAMPLER_RATE_HZ;
+
+  // Data channel: ADC FIFO -> ring
+  dma_channel_config dataCfg = dma_channel_get_default_config(_adcDataChannel);
+  channel_config_set_transfer_data_size(&dataCfg, DMA_SIZE_16);
+  channel_config_set_read_increment(&dataCfg, false);
+  channel_config_set_write_increment(&dataCfg, true);
+  channel_config_set_ring(&dataCfg, true, ADC_SAMPLER_RING_BITS);
+  channel_config_set_dreq(&dataCfg, DREQ_ADC);
+  channel_config_set_chain_to(&dataCfg, _adcControlChannel);
+  dma_channel_configure(_adcDataChannel, &dataCfg, _adcRing, &adc_hw->fifo, ADC_SAMPLER_DMA_CHUNK, false);
+
+  // Control channel: re-arms the data channel each time its chunk completes
+  dma_channel_config controlCfg = dma_channel_get_default_config(_adcControlChannel);
+  channel_config_set_transfer_data_size(&controlCfg, DMA_SIZE_32);
+  channel_config_set_read_increment(&controlCfg, false);
+  channel_config_set_write_increment(&controlCfg, false);
+  dma_channel_configure(_adcControlChannel, &controlCfg,
+      &dma_hw->ch[_adcDataChannel].al1_transfer_count_trig, &_adcReloadCount, 1, false);
+
+  dma_channel_start(_adcDataChannel);
+  _adcStartUs = micros();
+  adc_run(true);
+
+  _adcSamplerRunning = true;
+  Serial.printf("[ADC] Sampling %d input(s) at %d hz total (DMA %d/%d)\n",
+      numPins, ADC_SAMPLER_RATE_HZ, _adcDataChannel, _adcControlChannel);
+  return true;
+}
+
+bool adcSamplerIsRunning() {
+  return _adcSamplerRunning;
+}
+
+AdcReading adcSamplerRead(uint8_t pin) {
+  AdcReading reading = {-1.0f, 0, 0};
+  if (!_adcSamplerRunning) return reading;
+
+  int slot = -1;
+  for (int i = 0; i < _adcNumSlots; i++) {
+    if (_adcSlotPins[i] == pin) {
+      slot = i;
+      break;
+    }
+  }
+  if (slot < 0) return reading;
+
+  uint32_t nowUs = micros();
+
+  // The write address points at the next sample to be written, so the one
+  // before it is the newest complete sample
+  uint32_t writeIdx = (dma_hw->ch[_adcDataChannel].write_addr - (uint32_t)(uintptr_t)_adcRing) / sizeof(uint16_t);
+  int newest = (writeIdx - 1) & (ADC_SAMPLER_RING_LEN - 1);
+
+  // Step back to this pin's newest sample
+  int back = (newest - slot) & (_adcNumSlots - 1);
+  int idx = newest - back;
+
+  // Don't average in the zeroed ring before it has filled
+  uint32_t available = (nowUs - _adcStartUs) / (_adcSamplePeriodUs * _adcNumSlots);
+  int count = min((uint32_t)ADC_SAMPLER_OVERSAMPLE, available);
+  if (count == 0) return reading;
+
+  uint32_t sum = 0;
+  for (int i = 0; i < count; i++) {
+    sum += _adcRing[(idx - i * _adcNumSlots) & (ADC_SAMPLER_RING_LEN - 1)];
+  }
+
+  reading.value = (float)sum / (count * 4095.0f);
+  reading.timestampUs = nowUs - back * _adcSamplePeriodUs;
+  reading.samples = count;
+  return reading;
+}
+
+} // namespace xrp
@@ -0,0 +1,473 @@
+#include <math.h>
+#include <string.h>
+
+#include "ahrs.h"
+
+#define AHRS_DEFAULT_SAMPLE_FREQ 512.0f
+
+#define MADGWICK_DEFAULT_BETA 0.1f
+#define MAHONY_DEFAULT_KP 0.5f
+#define MAHONY_DEFAULT_KI 0.0f
+
+#define AHRS_DEG_TO_RAD 0.0174532925f
+#define AHRS_RAD_TO_DEG 57.2957795f
+
+// Q30: 1.0 is 1 << 30, so quaternion components (and sums of two of them) fit
+// in an int32
+#define AHRS_Q30_ONE (1LL << 30)
+#define AHRS_Q30_TO_FLOAT (1.0f / 1073741824.0f)
+
+// Accel counts per input unit (g) for the fixed point path. Only the direction
+// is used, so this sets the resolution of the gravity correction. 16 bits per g
+// keeps it within a few thousandths of a degree of the float filter
+#define AHRS_FIXED_ACCEL_SCALE 65536.0f
+
+#define ANGLE_ROLL 0x01
+#define ANGLE_PITCH 0x02
+#define ANGLE_YAW 0x04
+#define ANGLE_ALL (ANGLE_ROLL | ANGLE_PITCH | ANGLE_YAW)
+
+namespace xrp {
+
+/**
+ * 1/sqrt(x)
+ *
+ * The RP2350 has a hardware VSQRT/VDIV, which beats the bit trick and is exact.
+ * On the RP2040 every float op is a (ROM) library call, so the bit trick with two
+ * Newton iterations is both cheaper and accurate to ~1e-6
+ */
+static inline float _invSqrt(float x) {
+#ifdef PICO_RP2350
+  return 1.0f / sqrtf(x);
+#else
+  float halfx = 0.5f * x;
+  float y;
+  int32_t i;
+  memcpy(&i, &x, sizeof(i));
+  i = 0x5f3759df - (i >> 1);
+  memcpy(&y, &i, sizeof(y));
+  y = y * (1.5f - (halfx * y * y));
+  y = y * (1.5f - (halfx * y * y));
+  return y;
+#endif
+}
+
+static inline int32_t _q30Mul(int32_t a, int32_t b) {
+  return (int32_t)(((int64_t)a * b) >> 30);
+}
+
+/**
+ * Integer 1/sqrt(s) for a non-zero sum of squares.
+ *
+ * Returns y (Q30) and a shift such that (v * y) >> shift is v / sqrt(s) in Q30.
+ * s is scaled by an even power of two into [2^60, 2^62), so the root is taken
+ * of a Q30 value in [1, 4). A linear first guess plus four Newton steps gets to
+ * the limit of Q30
+ */
+static inline int32_t _q30InvSqrt(uint64_t s, int &shift) {
+  int k = __builtin_clzll(s) - 2;
+  if (k & 1) {
+    k -= 1;
+  }
+  uint64_t m = k >= 0 ? s << k : s >> -k;
+  int64_t x = (int64_t)(m >> 30);
+
+  // 1.2 - 0.2x is within 13% of 1/sqrt(x) over [1, 4)
+  int64_t y = ((AHRS_Q30_ONE * 6) / 5) - ((x * (AHRS_Q30_ONE / 5)) >> 30);
+  for (int i = 0; i < 4; i++) {
+    int64_t xyy = (x * ((y * y) >> 30)) >> 30;
+    y = (y * (3 * AHRS_Q30_ONE - xyy)) >> 31;
+  }
+
+  shift = 30 - k / 2;
+  return (int32_t)y;
+}
+
+// ===============================
+// OrientationFilter
+// ===============================
+
+OrientationFilter::OrientationFilter() :
+    _q0(1.0f), _q1(0.0f), _q2(0.0f), _q3(0.0f),
+    _invSampleFreq(1.0f / AHRS_DEFAULT_SAMPLE_FREQ),
+    _roll(0.0f), _pitch(0.0f), _yaw(0.0f),
+    _anglesDirty(ANGLE_ALL) {}
+
+void OrientationFilter::begin(float sampleFrequency) {
+  _invSampleFreq = 1.0f / sampleFrequency;
+  _updateScales();
+}
+
+void OrientationFilter::reset() {
+  _q0 = 1.0f;
+  _q1 = 0.0f;
+  _q2 = 0.0f;
+  _q3 = 0.0f;
+  _anglesDirty = ANGLE_ALL;
+}
+
+void OrientationFilter::_normalizeAndStore(float q0, float q1, float q2, float q3) {
+  float recipNorm = _invSqrt(q0 * q0 + q1 * q1 + q2 * q2 + q3 * q3);
+  _q0 = q0 * recipNorm;
+  _q1 = q1 * recipNorm;
+  _q2 = q2 * recipNorm;
+  _q3 = q3 * recipNorm;
+
+  _anglesDirty = ANGLE_ALL;
+}
+
+float OrientationFilter::getRoll() {
+  if (_anglesDirty & ANGLE_ROLL) {
+    _roll = atan2f(_q0 * _q1 + _q2 * _q3, 0.5f - _q1 * _q1 - _q2 * _q2) * AHRS_RAD_TO_DEG;
+    _anglesDirty &= ~ANGLE_ROLL;
+  }
+  return _roll;
+}
+
+float OrientationFilter::getPitch() {
+  if (_anglesDirty & ANGLE_PITCH) {
+    float sinp = -2.0f * (_q1 * _q3 - _q0 * _q2);
+    if (sinp > 1.0f) sinp = 1.0f;
+    if (sinp < -1.0f) sinp = -1.0f;
+    _pitch = asinf(sinp) * AHRS_RAD_TO_DEG;
+    _anglesDirty &= ~ANGLE_PITCH;
+  }
+  return _pitch;
+}
+
+float OrientationFilter::getYaw() {
+  // Matches the Arduino Madgwick library, which reports yaw as 0-360
+  if (_anglesDirty & ANGLE_YAW) {
+    _yaw = atan2f(_q1 * _q2 + _q0 * _q3, 0.5f - _q2 * _q2 - _q3 * _q3) * AHRS_RAD_TO_DEG + 180.0f;
+    _anglesDirty &= ~ANGLE_YAW;
+  }
+  return _yaw;
+}
+
+void OrientationFilter::getQuaternion(float q[4]) {
+  q[0] = _q0;
+  q[1] = _q1;
+  q[2] = _q2;
+  q[3] = _q3;
+}
+
+// ===============================
+// MadgwickFilter
+// ===============================
+
+MadgwickFilter::MadgwickFilter() : _beta(MADGWICK_DEFAULT_BETA) {
+  _updateScales();
+}
+
+void MadgwickFilter::setBeta(float beta) {
+  _beta = beta;
+  _updateScales();
+}
+
+void MadgwickFilter::_updateScales() {
+  // qDot = 0.5 * q x omega - beta * gradient, integrated over dt
+  _gyroScale = 0.5f * AHRS_DEG_TO_RAD * _invSampleFreq;
+  _betaDt = _beta * _invSampleFreq;
+}
+
+void MadgwickFilter::updateIMU(float gx, float gy, float gz, float ax, float ay, float az) {
+  float q0 = _q0;
+  float q1 = _q1;
+  float q2 = _q2;
+  float q3 = _q3;
+
+  // Gyro is pre-scaled so these are the quaternion deltas for this step
+  gx *= _gyroScale;
+  gy *= _gyroScale;
+  gz *= _gyroScale;
+
+  float dq0 = -q1 * gx - q2 * gy - q3 * gz;
+  float dq1 =  q0 * gx + q2 * gz - q3 * gy;
+  float dq2 =  q0 * gy - q1 * gz + q3 * gx;
+  float dq3 =  q0 * gz + q1 * gy - q2 * gx;
+
+  // Only apply the accelerometer correction when there is a valid measurement
+  if (!((ax == 0.0f) && (ay == 0.0f) && (az == 0.0f))) {
+    float recipNorm = _invSqrt(ax * ax + ay * ay + az * az);
+    ax *= recipNorm;
+    ay *= recipNorm;
+    az *= recipNorm;
+
+    float q0q0 = q0 * q0;
+    float q1q1 = q1 * q1;
+    float q2q2 = q2 * q2;
+    float q3q3 = q3 * q3;
+
+    // Gradient descent step, with the common factor of 2 pulled out (it is
+    // removed by the normalization below anyway)
+    float q1q1q2q2 = q1q1 + q2q2;
+    float s0 = 2.0f * q0 * q1q1q2q2 + q2 * ax - q1 * ay;
+    float s1 = 2.0f * q1 * (q3q3 + q0q0 + 2.0f * q1q1q2q2 - 1.0f + az) - q3 * ax - q0 * ay;
+    float s2 = 2.0f * q2 * (q0q0 + q3q3 + 2.0f * q1q1q2q2 - 1.0f + az) + q0 * ax - q3 * ay;
+    float s3 = 2.0f * q3 * q1q1q2q2 - q1 * ax - q2 * ay;
+
+    float sNorm = s0 * s0 + s1 * s1 + s2 * s2 + s3 * s3;
+    if (sNorm > 0.0f) {
+      recipNorm = _invSqrt(sNorm) * _betaDt;
+      dq0 -= s0 * recipNorm;
+      dq1 -= s1 * recipNorm;
+      dq2 -= s2 * recipNorm;
+      dq3 -= s3 * recipNorm;
+    }
+  }
+
+  _normalizeAndStore(q0 + dq0, q1 + dq1, q2 + dq2, q3 + dq3);
+}
+
+// ===============================
+// MadgwickFixedFilter
+// ===============================
+
+MadgwickFixedFilter::MadgwickFixedFilter() :
+    _beta(MADGWICK_DEFAULT_BETA),
+    _fq0(AHRS_Q30_ONE), _fq1(0), _fq2(0), _fq3(0),
+    _floatDirty(false) {
+  _updateScales();
+}
+
+void MadgwickFixedFilter::setBeta(float beta) {
+  _beta = beta;
+  _updateScales();
+}
+
+void MadgwickFixedFilter::reset() {
+  OrientationFilter::reset();
+  _fq0 = AHRS_Q30_ONE;
+  _fq1 = 0;
+  _fq2 = 0;
+  _fq3 = 0;
+  _floatDirty = false;
+}
+
+void MadgwickFixedFilter::_updateScales() {
+  _gyroScaleQ30 = 0.5f * AHRS_DEG_TO_RAD * _invSampleFreq * (float)AHRS_Q30_ONE;
+  _betaDtQ30 = (int32_t)(_beta * _invSampleFreq * (float)AHRS_Q30_ONE);
+}
+
+void MadgwickFixedFilter::updateIMU(float gx, float gy, float gz, float ax, float ay, float az) {
+  int32_t q0 = _fq0;
+  int32_t q1 = _fq1;
+  int32_t q2 = _fq2;
+  int32_t q3 = _fq3;
+
+  // Quaternion deltas for this step, as in MadgwickFilter
+  int32_t hx = (int32_t)(gx * _gyroScaleQ30);
+  int32_t hy = (int32_t)(gy * _gyroScaleQ30);
+  int32_t hz = (int32_t)(gz * _gyroScaleQ30);
+
+  int32_t dq0 = -_q30Mul(q1, hx) - _q30Mul(q2, hy) - _q30Mul(q3, hz);
+  int32_t dq1 =  _q30Mul(q0, hx) + _q30Mul(q2, hz) - _q30Mul(q3, hy);
+  int32_t dq2 =  _q30Mul(q0, hy) - _q30Mul(q1, hz) + _q30Mul(q3, hx);
+  int32_t dq3 =  _q30Mul(q0, hz) + _q30Mul(q1, hy) - _q30Mul(q2, hx);
+
+  int64_t iax = (int64_t)(ax * AHRS_FIXED_ACCEL_SCALE);
+  int64_t iay = (int64_t)(ay * AHRS_FIXED_ACCEL_SCALE);
+  int64_t iaz = (int64_t)(az * AHRS_FIXED_ACCEL_SCALE);
+
+  // Only apply the accelerometer correction when there is a valid measurement
+  uint64_t aNorm = iax * iax + iay * iay + iaz * iaz;
+  if (aNorm > 0) {
+    int shift;
+    int64_t recipNorm = _q30InvSqrt(aNorm, shift);
+    int32_t nax = (int32_t)((iax * recipNorm) >> shift);
+    int32_t nay = (int32_t)((iay * recipNorm) >> shift);
+    int32_t naz = (int32_t)((iaz * recipNorm) >> shift);
+
+    int32_t q0q0 = _q30Mul(q0, q0);
+    int32_t q3q3 = _q30Mul(q3, q3);
+    int64_t q1q1q2q2 = (int64_t)_q30Mul(q1, q1) + _q30Mul(q2, q2);
+
+    // Same gradient as the float filter. The terms can reach ~12, so they are
+    // formed in 64 bits and dropped to Q27 before the sum of squares
+    int64_t t = (int64_t)q0q0 + q3q3 + 2 * q1q1q2q2 - AHRS_Q30_ONE + naz;
+    int32_t s0 = (int32_t)((((q0 * q1q1q2q2) >> 29) + _q30Mul(q2, nax) - _q30Mul(q1, nay)) >> 3);
+    int32_t s1 = (int32_t)((((q1 * t) >> 29) - _q30Mul(q3, nax) - _q30Mul(q0, nay)) >> 3);
+    int32_t s2 = (int32_t)((((q2 * t) >> 29) + _q30Mul(q0, nax) - _q30Mul(q3, nay)) >> 3);
+    int32_t s3 = (int32_t)((((q3 * q1q1q2q2) >> 29) - _q30Mul(q1, nax) - _q30Mul(q2, nay)) >> 3);
+
+    uint64_t sNorm = (uint64_t)((int64_t)s0 * s0) + (uint64_t)((int64_t)s1 * s1) +
+        (uint64_t)((int64_t)s2 * s2) + (uint64_t)((int64_t)s3 * s3);
+    if (sNorm > 0) {
+      recipNorm = _q30InvSqrt(sNorm, shift);
+      dq0 -= _q30Mul((int32_t)((s0 * recipNorm) >> shift), _betaDtQ30);
+      dq1 -= _q30Mul((int32_t)((s1 * recipNorm) >> shift), _betaDtQ30);
+      dq2 -= _q30Mul((int32_t)((s2 * recipNorm) >> shift), _betaDtQ30);
+      dq3 -= _q30Mul((int32_t)((s3 * recipNorm) >> shift), _betaDtQ30);
+    }
+  }
+
+  int64_t n0 = q0 + dq0;
+  int64_t n1 = q1 + dq1;
+  int64_t n2 = q2 + dq2;
+  int64_t n3 = q3 + dq3;
+
+  int shift;
+  int64_t recipNorm = _q30InvSqrt((uint64_t)(n0 * n0 + n1 * n1 + n2 * n2 + n3 * n3), shift);
+  _fq0 = (int32_t)((n0 * recipNorm) >> shift);
+  _fq1 = (int32_t)((n1 * recipNorm) >> shift);
+  _fq2 = (int32_t)((n2 * recipNorm) >> shift);
+  _fq3 = (int32_t)((n3 * recipNorm) >> shift);
+
+  _floatDirty = true;
+}
+
+void MadgwickFixedFilter::_syncQuaternion() {
+  if (_floatDirty) {
+    _q0 = _fq0 * AHRS_Q30_TO_FLOAT;
+    _q1 = _fq1 * AHRS_Q30_TO_FLOAT;
+    _q2 = _fq2 * AHRS_Q30_TO_FLOAT;
+    _q3 = _fq3 * AHRS_Q30_TO_FLOAT;
+    _anglesDirty = ANGLE_ALL;
+    _floatDirty = false;
+  }
+}
+
+float MadgwickFixedFilter::getRoll() {
+  _syncQuaternion();
+  return OrientationFilter::getRoll();
+}
+
+float MadgwickFixedFilter::getPitch() {
+  _syncQuaternion();
+  return OrientationFilter::getPitch();
+}
+
+float MadgwickFixedFilter::getYaw() {
+  _syncQuaternion();
+  return OrientationFilter::getYaw();
+}
+
+void MadgwickFixedFilter::getQuaternion(float q[4]) {
+  _syncQuaternion();
+  OrientationFilter::getQuaternion(q);
+}
+
+// ===============================
+// MahonyFilter
+// ===============================
+
+MahonyFilter::MahonyFilter() :
+    _twoKp(2.0f * MAHONY_DEFAULT_KP),
+    _twoKi(2.0f * MAHONY_DEFAULT_KI),
+    _integralFB{0.0f, 0.0f, 0.0f} {
+  _updateScales();
+}
+
+void MahonyFilter::setGains(float kp, float ki) {
+  _twoKp = 2.0f * kp;
+  _twoKi = 2.0f * ki;
+}
+
+void MahonyFilter::reset() {
+  OrientationFilter::reset();
+  _integralFB[0] = 0.0f;
+  _integralFB[1] = 0.0f;
+  _integralFB[2] = 0.0f;
+}
+
+void MahonyFilter::_updateScales() {
+  _halfDt = 0.5f * _invSampleFreq;
+}
+
+void MahonyFilter::updateIMU(float gx, float gy, float gz, float ax, float ay, float az) {
+  float q0 = _q0;
+  float q1 = _q1;
+  float q2 = _q2;
+  float q3 = _q3;
+
+  gx *= AHRS_DEG_TO_RAD;
+  gy *= AHRS_DEG_TO_RAD;
+  gz *= AHRS_DEG_TO_RAD;
+
+  // Only apply the accelerometer correction when there is a valid measurement
+  if (!((ax == 0.0f) && (ay == 0.0f) && (az == 0.0f))) {
+    float recipNorm = _invSqrt(ax * ax + ay * ay + az * az);
+    ax *= recipNorm;
+    ay *= recipNorm;
+    az *= recipNorm;
+
+    // Estimated direction of gravity (half)
+    float halfvx = q1 * q3 - q0 * q2;
+    float halfvy = q0 * q1 + q2 * q3;
+    float halfvz = q0 * q0 - 0.5f + q3 * q3;
+
+    // Error is the cross product between estimated and measured gravity
+    float halfex = ay * halfvz - az * halfvy;
+    float halfey = az * halfvx - ax * halfvz;
+    float halfez = ax * halfvy - ay * halfvx;
+
+    if (_twoKi > 0.0f) {
+      _integralFB[0] += _twoKi * halfex * _invSampleFreq;
+      _integralFB[1] += _twoKi * halfey * _invSampleFreq;
+      _integralFB[2] += _twoKi * halfez * _invSampleFreq;
+      gx += _integralFB[0];
+      gy += _integralFB[1];
+      gz += _integralFB[2];
+    }
+
+    gx += _twoKp * halfex;
+    gy += _twoKp * halfey;
+    gz += _twoKp * halfez;
+  }
+
+  gx *= _halfDt;
+  gy *= _halfDt;
+  gz *= _halfDt;
+
+  _normalizeAndStore(
+      q0 + (-q1 * gx - q2 * gy - q3 * gz),
+      q1 + ( q0 * gx + q2 * gz - q3 * gy),
+      q2 + ( q0 * gy - q1 * gz + q3 * gx),
+      q3 + ( q0 * gz + q1 * gy - q2 * gx));
+}
+
+// ===============================
+// YawOnlyFilter
+// ===============================
+
+// The quaternion filters start at yaw = 180 (atan2 + 180), so match that
+YawOnlyFilter::YawOnlyFilter() : _yawDeg(180.0f) {}
+
+void YawOnlyFilter::reset() {
+  OrientationFilter::reset();
+  _yawDeg = 180.0f;
+}
+
+void YawOnlyFilter::updateIMU(float gx, float gy, float gz, float ax, float ay, float az) {
+  _yawDeg += gz * _invSampleFreq;
+
+  if (_yawDeg >= 360.0f) {
+    _yawDeg -= 360.0f;
+  }
+  else if (_yawDeg < 0.0f) {
+    _yawDeg += 360.0f;
+  }
+}
+
+float YawOnlyFilter::getRoll() {
+  return 0.0f;
+}
+
+float YawOnlyFilter::getPitch() {
+  return 0.0f;
+}
+
+float YawOnlyFilter::getYaw() {
+  return _yawDeg;
+}
+
+void YawOnlyFilter::getQuaternion(float q[4]) {
+  // Rotation about Z only. Only computed on request, since it needs sin/cos
+  float halfYawRad = (_yawDeg - 180.0f) * AHRS_DEG_TO_RAD * 0.5f;
+  q[0] = cosf(halfYawRad);
+  q[1] = 0.0f;
+  q[2] = 0.0f;
+  q[3] = sinf(halfYawRad);
+}
+
+} // namespace xrp
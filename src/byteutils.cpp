@@ -2,85 +2,77 @@
 
 #include "byteutils.h"
 
-// NOTE: The RP2040 is Little Endian, and Network Byte Order is Big Endian
+// NOTE: The RP2040 is Little Endian, and Network Byte Order is Big Endian.
+// The byte swapping itself lives in the inline codec in byteutils.h
 
 float networkToFloat(char* buf, int offset) {
   float f;
-  unsigned char b[] = {buf[offset+3], buf[offset+2], buf[offset+1], buf[offset+0]};
-  memcpy(&f, &b, sizeof(f));
+  fromNetwork(buf, offset, f);
   return f;
 }
 
 int16_t networkToInt16(char* buf, int offset) {
   int16_t i;
-  unsigned char b[] = {buf[offset+1], buf[offset+0]};
-  memcpy(&i, &b, sizeof(i));
+  fromNetwork(buf, offset, i);
   return i;
 }
 
 uint16_t networkToUInt16(char* buf, int offset) {
   uint16_t u;
-  unsigned char b[] = {buf[offset+1], buf[offset+0]};
-  memcpy(&u, &b, sizeof(u));
+  fromNetwork(buf, offset, u);
   return u;
 }
 
 int32_t networkToInt32(char* buf, int offset) {
   int32_t i;
-  unsigned char b[] = {buf[offset+3], buf[offset+2], buf[offset+1], buf[offset+0]};
-  memcpy(&i, &b, sizeof(i));
+  fromNetwork(buf, offset, i);
   return i;
 }
 
 uint32_t networkToUInt32(char* buf, int offset) {
   uint32_t u;
-  unsigned char b[] = {buf[offset+3], buf[offset+2], buf[offset+1], buf[offset+0]};
-  memcpy(&u, &b, sizeof(u));
+  fromNetwork(buf, offset, u);
   return u;
 }
 
 void floatToNetwork(float num, char* buf, int offset) {
-  unsigned char b[4];
-  memcpy(&b, &num, sizeof(num));
-
-  buf[offset+0] = b[3];
-  buf[offset+1] = b[2];
-  buf[offset+2] = b[1];
-  buf[offset+3] = b[0];
+  toNetwork(num, buf, offset);
 }
 
 void int16ToNetwork(int16_t num, char* buf, int offset) {
-  unsigned char b[2];
-  memcpy(&b, &num, sizeof(num));
-
-  buf[offset+0] = b[1];
-  buf[offset+1] = b[0];
+  toNetwork(num, buf, offset);
 }
 
 void uint16ToNetwork(uint16_t num, char* buf, int offset) {
-  unsigned char b[2];
-  memcpy(&b, &num, sizeof(num));
-
-  buf[offset+0] = b[1];
-  buf[offset+1] = b[0];
+  toNetwork(num, buf, offset);
 }
 
 void int32ToNetwork(int32_t num, char* buf, int offset) {
-  unsigned char b[4];
-  memcpy(&b, &num, sizeof(num));
-
-  buf[offset+0] = b[3];
-  buf[offset+1] = b[2];
-  buf[offset+2] = b[1];
-  buf[offset+3] = b[0];
+  toNetwork(num, buf, offset);
 }
 
 void uint32ToNetwork(uint32_t num, char* buf, int offset) {
-  unsigned char b[4];
-  memcpy(&b, &num, sizeof(num));
+  toNetwork(num, buf, offset);
+}
 
-  buf[offset+0] = b[3];
-  buf[offset+1] = b[2];
-  buf[offset+2] = b[1];
-  buf[offset+3] = b[0];
-}
\ No newline at end of file
+int varintToNetwork(uint32_t num, char* buf, int offset) {
+  int i = offset;
+  while (num >= 0x80) {
+    buf[i++] = (num & 0x7F) | 0x80;
+    num >>= 7;
+  }
+  buf[i++] = num;
+  return i - offset;
+}
+
+int zigzagVarintToNetwork(int32_t num, char* buf, int offset) {
+  uint32_t zigzag = ((uint32_t)num << 1) ^ (uint32_t)(num >> 31);
+  return varintToNetwork(zigzag, buf, offset);
+}
+
+int16_t floatToFixedPoint(float value, float scale) {
+  float scaled = value * scale;
+  if (scaled > 32767.0f) return 32767;
+  if (scaled < -32768.0f) return -32768;
+  return (int16_t)(scaled < 0 ? scaled - 0.5f : scaled + 0.5f);
+}
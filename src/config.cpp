@@ -76,6 +76,7 @@ std::string XRPConfiguration::toJsonString() {
 
   JsonArray prefNetworks = network["networkList"].to<JsonArray>();
   network["mode"] = networkConfig.mode == NetworkMode::AP ? "AP" : "STA";
+  network["mtu"] = networkConfig.mtu;
 
   for (auto netInfo : networkConfig.networkList) {
     JsonDocument networkObj;
@@ -84,6 +85,26 @@ std::string XRPConfiguration::toJsonString() {
     prefNetworks.add(networkObj);
   }
 
+  // Motors
+  JsonObject motors = config["motors"].to<JsonObject>();
+  JsonArray slewRates = motors["slewRates"].to<JsonArray>();
+  for (auto rate : motorConfig.slewRates) {
+    slewRates.add(rate);
+  }
+
+  // Servos
+  JsonObject servos = config["servos"].to<JsonObject>();
+  JsonArray rateLimits = servos["rateLimits"].to<JsonArray>();
+  for (auto rate : servoConfig.rateLimits) {
+    rateLimits.add(rate);
+  }
+
+  // IMU
+  JsonObject imu = config["imu"].to<JsonObject>();
+  imu["sampleRateHz"] = imuConfig.sampleRateHz;
+  imu["filter"] = imuConfig.filter;
+  imu["orientation"] = imuConfig.orientation;
+
   std::string ret;
   serializeJsonPretty(config, ret);
   return ret;
@@ -201,6 +222,63 @@ XRPConfiguration loadConfiguration(std::string defaultAPName) {
     shouldWrite = true;
   }
 
+  if (networkInfo["mtu"].is<int>()) {
+    config.networkConfig.mtu = networkInfo["mtu"];
+  }
+  else {
+    Serial.println("[CONFIG] Network MTU missing. Using default");
+    shouldWrite = true;
+  }
+
+  // Motor Section
+  if (configJson["motors"]["slewRates"].is<JsonArray>()) {
+    JsonArray slewRates = configJson["motors"]["slewRates"].as<JsonArray>();
+    for (int i = 0; i < slewRates.size() && i < config.motorConfig.slewRates.size(); i++) {
+      config.motorConfig.slewRates[i] = slewRates[i].as<float>();
+    }
+  }
+  else {
+    Serial.println("[CONFIG] Motor slew rates missing. Using defaults");
+    shouldWrite = true;
+  }
+
+  // Servo Section
+  if (configJson["servos"]["rateLimits"].is<JsonArray>()) {
+    JsonArray rateLimits = configJson["servos"]["rateLimits"].as<JsonArray>();
+    for (int i = 0; i < rateLimits.size() && i < config.servoConfig.rateLimits.size(); i++) {
+      config.servoConfig.rateLimits[i] = rateLimits[i].as<float>();
+    }
+  }
+  else {
+    Serial.println("[CONFIG] Servo rate limits missing. Using defaults");
+    shouldWrite = true;
+  }
+
+  // IMU Section
+  if (configJson["imu"]["sampleRateHz"].is<int>()) {
+    config.imuConfig.sampleRateHz = configJson["imu"]["sampleRateHz"];
+  }
+  else {
+    Serial.println("[CONFIG] IMU sample rate missing. Using default");
+    shouldWrite = true;
+  }
+
+  if (configJson["imu"]["filter"].is<JsonString>()) {
+    config.imuConfig.filter = configJson["imu"]["filter"].as<std::string>();
+  }
+  else {
+    Serial.println("[CONFIG] IMU filter missing. Using default");
+    shouldWrite = true;
+  }
+
+  if (configJson["imu"]["orientation"].is<JsonString>()) {
+    config.imuConfig.orientation = configJson["imu"]["orientation"].as<std::string>();
+  }
+  else {
+    Serial.println("[CONFIG] IMU orientation format missing. Using default");
+    shouldWrite = true;
+  }
+
   if (shouldWrite) {
     writeConfigToDisk(config);
   }
@@ -0,0 +1,120 @@
+#include "events.h"
+#include "imu.h"
+#include "robot.h"
+
+// Distance a reading has to come back past the threshold before the event
+// clears, so noise on the threshold doesn't flood the host
+#define EVENT_LINE_HYSTERESIS_V 0.2f
+#define EVENT_RANGE_HYSTERESIS_V 0.1f
+
+// A collision clears once the accel magnitude drops below this fraction of the threshold
+#define EVENT_COLLISION_CLEAR_RATIO 0.5f
+
+namespace xrp {
+
+struct EventSubscription {
+  bool enabled;
+  float threshold;
+};
+
+EventSubscription _eventSubs[(int)RobotEvent::COUNT];
+EventState _eventStates[(int)RobotEvent::COUNT];
+
+void eventsReset() {
+  for (int i = 0; i < (int)RobotEvent::COUNT; i++) {
+    _eventSubs[i] = {false, 0.0f};
+    _eventStates[i] = {false, 0, 0.0f};
+  }
+
+  _eventSubs[(int)RobotEvent::BUTTON].enabled = true;
+  _eventStates[(int)RobotEvent::BUTTON].active = isUserButtonPressed();
+}
+
+bool eventsSubscribe(uint8_t event, bool enabled, float threshold) {
+  if (event >= (uint8_t)RobotEvent::COUNT) return false;
+
+  _eventSubs[event] = {enabled, threshold};
+
+  // Start from inactive, so a condition that already holds is reported on the next poll
+  _eventStates[event] = {false, 0, 0.0f};
+  if (event == (uint8_t)RobotEvent::BUTTON) {
+    _eventStates[event].active = isUserButtonPressed();
+  }
+  return true;
+}
+
+EventState eventsGetState(RobotEvent event) {
+  return _eventStates[(int)event];
+}
+
+// Evaluates the condition for an event, with hysteresis around its current state.
+// Returns false if there's no usable reading
+static bool _eventCheck(RobotEvent event, float threshold, bool active, bool &newActive, float &value) {
+  switch (event) {
+    case RobotEvent::BUTTON:
+      value = isUserButtonPressed() ? 1.0f : 0.0f;
+      newActive = value > 0.0f;
+      return true;
+    case RobotEvent::LINE_LEFT:
+    case RobotEvent::LINE_RIGHT: {
+      if (!reflectanceInitialized()) return false;
+      AnalogReading reading = (event == RobotEvent::LINE_LEFT) ? getReflectanceLeft() : getReflectanceRight();
+      if (!reading.valid) return false;
+      value = reading.voltage;
+      newActive = active ? value > threshold - EVENT_LINE_HYSTERESIS_V : value > threshold;
+      return true;
+    }
+    case RobotEvent::RANGE_NEAR: {
+      if (!rangefinderInitialized()) return false;
+      AnalogReading reading = getRangefinder();
+      if (!reading.valid) return false;
+      value = reading.voltage;
+      newActive = active ? value < threshold + EVENT_RANGE_HYSTERESIS_V : value < threshold;
+      return true;
+    }
+    case RobotEvent::COLLISION: {
+      // The accel reads zero until the first sample and goes stale while the
+      // IMU recovers, which would look like a 1g hit
+      if (!imuIsReady()) return false;
+      ImuHealth health = imuGetHealth().state;
+      if (health != ImuHealth::OK && health != ImuHealth::DEGRADED) return false;
+
+      float x = imuGetAccelX();
+      float y = imuGetAccelY();
+      float z = imuGetAccelZ();
+      if (x == 0.0f && y == 0.0f && z == 0.0f) return false;
+
+      value = fabsf(sqrtf(x * x + y * y + z * z) - 1.0f);
+      newActive = active ? value > threshold * EVENT_COLLISION_CLEAR_RATIO : value > threshold;
+      return true;
+    }
+    default:
+      return false;
+  }
+}
+
+uint32_t eventsPoll() {
+  uint32_t changed = 0;
+  uint32_t nowUs = micros();
+
+  for (int i = 0; i < (int)RobotEvent::COUNT; i++) {
+    if (!_eventSubs[i].enabled) continue;
+
+    EventState &state = _eventStates[i];
+    if (state.timeUs != 0 && nowUs - state.timeUs < EVENT_MIN_INTERVAL_US) continue;
+
+    bool newActive;
+    float value;
+    if (!_eventCheck((RobotEvent)i, _eventSubs[i].threshold, state.active, newActive, value)) continue;
+    if (newActive == state.active) continue;
+
+    state.active = newActive;
+    state.timeUs = nowUs;
+    state.value = value;
+    changed |= (1 << i);
+  }
+
+  return changed;
+}
+
+} // namespace xrp
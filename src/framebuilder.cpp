@@ -0,0 +1,134 @@
+#include <algorithm>
+#include <string.h>
+
+#include "byteutils.h"
+#include "framebuilder.h"
+
+namespace wpilibudp {
+
+void FrameBuilder::setMtu(int mtu) {
+  _mtu = std::max(FRAME_MIN_MTU, std::min(mtu, FRAME_MAX_MTU));
+}
+
+void FrameBuilder::_startDatagram() {
+  uint16ToNetwork(_seq, _buffer);
+  _buffer[2] = 0; // Unset the control byte
+  _len = FRAME_HEADER_SIZE;
+  _encoderRun = -1;
+}
+
+void FrameBuilder::flush() {
+  if (_len <= FRAME_HEADER_SIZE) {
+    _len = 0;
+    return;
+  }
+
+  _send(_buffer, _len);
+  _seq++;
+  _len = 0;
+}
+
+int FrameBuilder::remaining() const {
+  int used = (_len == 0) ? FRAME_HEADER_SIZE : _len;
+  return _mtu - used;
+}
+
+void FrameBuilder::addDeviceTime(uint32_t timeUs) {
+  _append<XRP_MSG_SIZE_DEVICE_TIME>([&](char* buffer, int offset) {
+    return writeDeviceTimeData(timeUs, buffer, offset);
+  });
+}
+
+void FrameBuilder::addDescriptor(const char* firmwareVersion, int firmwareVersionLen) {
+  _append<XRP_MSG_SIZE_DESCRIPTOR>([&](char* buffer, int offset) {
+    return writeDescriptorData(firmwareVersion, firmwareVersionLen, buffer, offset);
+  });
+}
+
+void FrameBuilder::addEncoder(int deviceId, int count, unsigned period, unsigned divisor) {
+  int run = _encoderRun;
+  int start = _append<XRP_MSG_SIZE_ENCODER>([&](char* buffer, int offset) {
+    return writeEncoderData(deviceId, count, period, divisor, buffer, offset);
+  });
+  if (start < 0 || !sessionCompact()) {
+    return;
+  }
+
+  // A compact encoder message can hold any number of id/count/period entries,
+  // so one straight after another drops its size and tag bytes and joins it
+  uint8_t runSize = (run >= 0) ? (uint8_t)_buffer[run] : 0;
+  int entryLen = _len - start - 2;
+  if (run >= 0 && run + runSize + 1 == start && runSize + entryLen <= 255) {
+    memmove(_buffer + start, _buffer + start + 2, entryLen);
+    _buffer[run] = runSize + entryLen;
+    _len -= 2;
+    _encoderRun = run;
+  }
+  else {
+    _encoderRun = start;
+  }
+}
+
+void FrameBuilder::addDIO(int deviceId, bool value) {
+  _append<XRP_MSG_SIZE_DIO>([&](char* buffer, int offset) {
+    return writeDIOData(deviceId, value, buffer, offset);
+  });
+}
+
+void FrameBuilder::addGyro(float rates[3], float angles[3]) {
+  _append<XRP_MSG_SIZE_GYRO>([&](char* buffer, int offset) {
+    return writeGyroData(rates, angles, buffer, offset);
+  });
+}
+
+void FrameBuilder::addQuaternion(float quat[4], float rates[3]) {
+  _append<XRP_MSG_SIZE_QUATERNION>([&](char* buffer, int offset) {
+    return writeQuaternionData(quat, rates, buffer, offset);
+  });
+}
+
+void FrameBuilder::addAccel(float accels[3]) {
+  _append<XRP_MSG_SIZE_ACCEL>([&](char* buffer, int offset) {
+    return writeAccelData(accels, buffer, offset);
+  });
+}
+
+void FrameBuilder::addImuHealth(uint8_t state, uint16_t errorCount, uint16_t recoveryCount) {
+  _append<XRP_MSG_SIZE_IMU_HEALTH>([&](char* buffer, int offset) {
+    return writeImuHealthData(state, errorCount, recoveryCount, buffer, offset);
+  });
+}
+
+void FrameBuilder::addAnalog(int deviceId, float voltage, uint16_t ageMs, bool valid) {
+  _append<XRP_MSG_SIZE_ANALOG>([&](char* buffer, int offset) {
+    return writeAnalogData(deviceId, voltage, ageMs, valid, buffer, offset);
+  });
+}
+
+void FrameBuilder::addMotorState(int deviceId, float target, float output) {
+  _append<XRP_MSG_SIZE_MOTOR_STATE>([&](char* buffer, int offset) {
+    return writeMotorStateData(deviceId, target, output, buffer, offset);
+  });
+}
+
+void FrameBuilder::addEvent(uint8_t event, bool active, uint32_t timeUs, float value) {
+  _append<XRP_MSG_SIZE_EVENT>([&](char* buffer, int offset) {
+    return writeEventData(event, active, timeUs, value, buffer, offset);
+  });
+}
+
+void FrameBuilder::addHistoryResponses() {
+  // Don't start a datagram just for answers that won't fit in it
+  if (remaining() < XRP_MSG_SIZE_HISTORY_SAMPLE) {
+    flush();
+  }
+  if (_len == 0) {
+    _startDatagram();
+  }
+
+  // writeHistoryResponses() checks each sample against maxLen itself
+  _encoderRun = -1;
+  _len += writeHistoryResponses(_buffer, _len, _mtu - _len);
+}
+
+} // namespace wpilibudp
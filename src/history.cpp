@@ -0,0 +1,152 @@
+#include "history.h"
+
+namespace xrp {
+
+struct HistoryRing {
+  HistorySample samples[HISTORY_LENGTH];
+  int head;  // Next slot to write
+  int count;
+};
+
+HistoryRing _history[(int)HistorySensor::COUNT];
+
+const uint8_t _historyFields[(int)HistorySensor::COUNT] = {
+  2, 2, 2, 2, // Encoders
+  3, 3, 3,    // Gyro rate, gyro angle, accel
+  1, 1, 1     // Analog
+};
+
+// Timestamps wrap every ~71 minutes, so compare by difference
+static inline int32_t _timeDiff(uint32_t a, uint32_t b) {
+  return (int32_t)(a - b);
+}
+
+// i = 0 is the oldest sample
+static inline const HistorySample& _historyAt(const HistoryRing &ring, int i) {
+  int idx = (ring.head - ring.count + i + HISTORY_LENGTH) % HISTORY_LENGTH;
+  return ring.samples[idx];
+}
+
+int historyFieldCount(uint8_t sensor) {
+  if (sensor >= (uint8_t)HistorySensor::COUNT) return 0;
+  return _historyFields[sensor];
+}
+
+// Fields that hold a raw value rather than a float. These are never blended
+static inline bool _historyFieldIsRaw(uint8_t sensor, int field) {
+  return sensor <= (uint8_t)HistorySensor::ENCODER_3 && field == 1;
+}
+
+void historyRecord(HistorySensor sensor, uint32_t timeUs, const float *values) {
+  HistoryValue fields[HISTORY_MAX_FIELDS];
+  for (int i = 0; i < _historyFields[(int)sensor]; i++) {
+    fields[i].f = values[i];
+  }
+  historyRecord(sensor, timeUs, fields);
+}
+
+void historyRecord(HistorySensor sensor, uint32_t timeUs, const HistoryValue *values) {
+  HistoryRing &ring = _history[(int)sensor];
+  if (ring.count > 0 && _timeDiff(timeUs, _historyAt(ring, ring.count - 1).timeUs) <= 0) {
+    return;
+  }
+
+  HistorySample &sample = ring.samples[ring.head];
+
+  sample.timeUs = timeUs;
+  for (int i = 0; i < _historyFields[(int)sensor]; i++) {
+    sample.values[i] = values[i];
+  }
+
+  ring.head = (ring.head + 1) % HISTORY_LENGTH;
+  if (ring.count < HISTORY_LENGTH) {
+    ring.count++;
+  }
+}
+
+bool historyRecordDue(HistorySensor sensor, uint32_t timeUs) {
+  const HistoryRing &ring = _history[(int)sensor];
+  if (ring.count == 0) return true;
+  return _timeDiff(timeUs, _historyAt(ring, ring.count - 1).timeUs) >= HISTORY_RECORD_PERIOD_US;
+}
+
+bool historyQueryAt(uint8_t sensor, uint32_t timeUs, HistorySample &out, uint8_t &flags) {
+  int numFields = historyFieldCount(sensor);
+  if (numFields == 0) return false;
+
+  const HistoryRing &ring = _history[sensor];
+  if (ring.count == 0) return false;
+
+  const HistorySample &oldest = _historyAt(ring, 0);
+  const HistorySample &newest = _historyAt(ring, ring.count - 1);
+
+  if (_timeDiff(timeUs, oldest.timeUs) <= 0 || _timeDiff(timeUs, newest.timeUs) >= 0) {
+    out = _timeDiff(timeUs, oldest.timeUs) <= 0 ? oldest : newest;
+    flags = (out.timeUs == timeUs) ? HISTORY_FLAG_EXACT : HISTORY_FLAG_CLAMPED;
+    return true;
+  }
+
+  // Find the pair that brackets the requested time, searching from the newest
+  // end since most queries are for recent samples
+  int i = ring.count - 2;
+  while (i > 0 && _timeDiff(_historyAt(ring, i).timeUs, timeUs) > 0) {
+    i--;
+  }
+
+  const HistorySample &before = _historyAt(ring, i);
+  const HistorySample &after = _historyAt(ring, i + 1);
+
+  if (before.timeUs == timeUs) {
+    out = before;
+    flags = HISTORY_FLAG_EXACT;
+    return true;
+  }
+
+  float t = (float)_timeDiff(timeUs, before.timeUs) / (float)_timeDiff(after.timeUs, before.timeUs);
+
+  out.timeUs = timeUs;
+  for (int f = 0; f < numFields; f++) {
+    // A period between a stopped and a moving sample (or one with the other
+    // direction bit) means nothing, so take the nearer sample's as it is
+    if (_historyFieldIsRaw(sensor, f)) {
+      out.values[f] = (t < 0.5f) ? before.values[f] : after.values[f];
+      continue;
+    }
+
+    float delta = after.values[f].f - before.values[f].f;
+
+    // Yaw wraps at 360, so take the short way around. The result isn't
+    // rewrapped: the live yaw has the reset offset taken off, so it can be
+    // anywhere in (-360, 360), and the answer has to match the stored samples
+    if (sensor == (uint8_t)HistorySensor::GYRO_ANGLE && f == 2) {
+      if (delta > 180.0f) delta -= 360.0f;
+      else if (delta < -180.0f) delta += 360.0f;
+    }
+
+    out.values[f].f = before.values[f].f + t * delta;
+  }
+
+  flags = HISTORY_FLAG_INTERPOLATED;
+  return true;
+}
+
+int historyQueryWindow(uint8_t sensor, uint32_t startUs, uint32_t endUs,
+                       HistorySample *out, int maxSamples, bool startExclusive) {
+  if (historyFieldCount(sensor) == 0) return 0;
+
+  const HistoryRing &ring = _history[sensor];
+  int written = 0;
+
+  for (int i = 0; i < ring.count && written < maxSamples; i++) {
+    const HistorySample &sample = _historyAt(ring, i);
+    int32_t sinceStart = _timeDiff(sample.timeUs, startUs);
+    if (sinceStart < 0 || (startExclusive && sinceStart == 0)) continue;
+    if (_timeDiff(sample.timeUs, endUs) > 0) break;
+
+    out[written++] = sample;
+  }
+
+  return written;
+}
+
+} // namespace xrp
@@ -0,0 +1,172 @@
+#include <Arduino.h>
+#include <hardware/dma.h>
+#include <hardware/i2c.h>
+#include <hardware/irq.h>
+
+#include "i2casync.h"
+
+// Worst case time per byte (100 kHz, plus clock stretching), used to detect a stuck transfer
+#define I2C_ASYNC_US_PER_BYTE 120
+#define I2C_ASYNC_BASE_TIMEOUT_US 1000
+
+namespace xrp {
+
+i2c_inst_t *_asyncI2c = nullptr;
+int _txDmaChannel = -1;
+int _rxDmaChannel = -1;
+
+// One command word per byte read, plus the register address write
+uint32_t _cmdBuffer[I2C_ASYNC_MAX_READ_LEN + 1];
+
+volatile bool _asyncBusy = false;
+unsigned long _asyncStartUs = 0;
+unsigned long _asyncTimeoutUs = 0;
+I2cAsyncCallback _asyncCallback = nullptr;
+void *_asyncContext = nullptr;
+
+void _i2cAsyncFinish(bool success) {
+  i2c_get_hw(_asyncI2c)->dma_cr = 0;
+
+  I2cAsyncCallback callback = _asyncCallback;
+  void *context = _asyncContext;
+  _asyncBusy = false;
+
+  if (callback) {
+    callback(success, context);
+  }
+}
+
+void _i2cAsyncDmaIrq() {
+  if (_rxDmaChannel < 0 || !dma_channel_get_irq1_status(_rxDmaChannel)) return;
+  dma_channel_acknowledge_irq1(_rxDmaChannel);
+
+  if (_asyncBusy) {
+    _i2cAsyncFinish(true);
+  }
+}
+
+bool i2cAsyncInit(TwoWire *wire) {
+  if (_asyncI2c) return true;
+
+  // Wire is always on I2C0 and Wire1 on I2C1
+  i2c_inst_t *i2c = (wire == &Wire1) ? i2c1 : i2c0;
+
+  _txDmaChannel = dma_claim_unused_channel(false);
+  _rxDmaChannel = dma_claim_unused_channel(false);
+  if (_txDmaChannel < 0 || _rxDmaChannel < 0) {
+    Serial.println("[I2C] No free DMA channels for async transfers");
+    if (_txDmaChannel >= 0) dma_channel_unclaim(_txDmaChannel);
+    if (_rxDmaChannel >= 0) dma_channel_unclaim(_rxDmaChannel);
+    _txDmaChannel = -1;
+    _rxDmaChannel = -1;
+    return false;
+  }
+
+  dma_channel_set_irq1_enabled(_rxDmaChannel, true);
+  irq_add_shared_handler(DMA_IRQ_1, _i2cAsyncDmaIrq, PICO_SHARED_IRQ_HANDLER_DEFAULT_ORDER_PRIORITY);
+  irq_set_enabled(DMA_IRQ_1, true);
+
+  _asyncI2c = i2c;
+  Serial.printf("[I2C] Async transfers on I2C%d (DMA %d/%d)\n", i2c_hw_index(i2c), _txDmaChannel, _rxDmaChannel);
+  return true;
+}
+
+bool i2cAsyncReadRegisters(uint8_t addr, uint8_t reg, uint8_t *buffer, size_t len,
+                           I2cAsyncCallback callback, void *context) {
+  if (!_asyncI2c || _asyncBusy || len == 0 || len > I2C_ASYNC_MAX_READ_LEN) {
+    return false;
+  }
+
+  i2c_hw_t *hw = i2c_get_hw(_asyncI2c);
+
+  // Same sequence as the SDK's blocking calls: the target address can only be
+  // changed while the block is disabled
+  hw->enable = 0;
+  hw->tar = addr;
+  hw->enable = 1;
+
+  // Register address (no stop), then a read command per byte with a restart
+  // on the first and a stop on the last
+  _cmdBuffer[0] = reg;
+  for (size_t i = 0; i < len; i++) {
+    uint32_t cmd = I2C_IC_DATA_CMD_CMD_BITS;
+    if (i == 0) cmd |= I2C_IC_DATA_CMD_RESTART_BITS;
+    if (i == len - 1) cmd |= I2C_IC_DATA_CMD_STOP_BITS;
+    _cmdBuffer[i + 1] = cmd;
+  }
+
+  _asyncCallback = callback;
+  _asyncContext = context;
+  _asyncStartUs = micros();
+  _asyncTimeoutUs = I2C_ASYNC_BASE_TIMEOUT_US + (len + 1) * I2C_ASYNC_US_PER_BYTE;
+  _asyncBusy = true;
+
+  dma_channel_config rxCfg = dma_channel_get_default_config(_rxDmaChannel);
+  channel_config_set_transfer_data_size(&rxCfg, DMA_SIZE_8);
+  channel_config_set_read_increment(&rxCfg, false);
+  channel_config_set_write_increment(&rxCfg, true);
+  channel_config_set_dreq(&rxCfg, i2c_get_dreq(_asyncI2c, false));
+  dma_channel_configure(_rxDmaChannel, &rxCfg, buffer, &hw->data_cmd, len, true);
+
+  dma_channel_config txCfg = dma_channel_get_default_config(_txDmaChannel);
+  channel_config_set_transfer_data_size(&txCfg, DMA_SIZE_32);
+  channel_config_set_read_increment(&txCfg, true);
+  channel_config_set_write_increment(&txCfg, false);
+  channel_config_set_dreq(&txCfg, i2c_get_dreq(_asyncI2c, true));
+  dma_channel_configure(_txDmaChannel, &txCfg, &hw->data_cmd, _cmdBuffer, len + 1, false);
+
+  hw->dma_cr = I2C_IC_DMA_CR_TDMAE_BITS | I2C_IC_DMA_CR_RDMAE_BITS;
+  dma_channel_start(_txDmaChannel);
+  return true;
+}
+
+bool i2cAsyncBusy() {
+  return _asyncBusy;
+}
+
+bool i2cAsyncWait(unsigned long timeoutUs) {
+  unsigned long start = micros();
+  while (_asyncBusy) {
+    i2cAsyncPoll();
+    if (micros() - start > timeoutUs) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void i2cAsyncPoll() {
+  if (!_asyncBusy) return;
+
+  i2c_hw_t *hw = i2c_get_hw(_asyncI2c);
+  bool aborted = hw->raw_intr_stat & I2C_IC_RAW_INTR_STAT_TX_ABRT_BITS;
+  bool timedOut = micros() - _asyncStartUs > _asyncTimeoutUs;
+
+  if (!aborted && !timedOut) return;
+
+  // The RX channel may complete between the check and here, so stop the
+  // interrupt from racing us
+  bool failed = false;
+  uint32_t irqState = save_and_disable_interrupts();
+  if (_asyncBusy) {
+    dma_channel_abort(_txDmaChannel);
+    dma_channel_abort(_rxDmaChannel);
+    dma_channel_acknowledge_irq1(_rxDmaChannel);
+
+    // Reading clears the abort, and the hardware has already flushed the TX FIFO
+    (void)hw->clr_tx_abrt;
+    while (hw->rxflr) {
+      (void)hw->data_cmd;
+    }
+
+    _i2cAsyncFinish(false);
+    failed = true;
+  }
+  restore_interrupts(irqState);
+
+  if (failed) {
+    Serial.printf("[I2C] Async transfer %s\n", aborted ? "aborted" : "timed out");
+  }
+}
+
+} // namespace xrp
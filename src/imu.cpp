@@ -1,13 +1,125 @@
+#include <LittleFS.h>
+#include <stddef.h>
+
+#include "i2casync.h"
 #include "imu.h"
+#include "pins.h"
 
-#include <MadgwickAHRS.h>
+#include "ahrs.h"
+#include "history.h"
 
 #define IMU_DEFAULT_CALIBRATION_TIME_MS 3000
 
-#define IMU_MADGWICK_LOOP_FREQ_HZ 25
+// Saved calibration, used to skip the full calibration on boot
+#define IMU_CALIBRATION_FILE "/imucal.bin"
+#define IMU_CALIBRATION_MAGIC 0x58494D55 // "XIMU"
+#define IMU_CALIBRATION_VERSION 1
+#define IMU_CALIBRATION_CHECK_TIME_MS 300
+#define IMU_CALIBRATION_MAX_TEMP_DELTA_C 10.0f
+#define IMU_CALIBRATION_MAX_GYRO_DELTA_DPS 0.5f
+#define IMU_CALIBRATION_MAX_ACCEL_DELTA_G 0.05f
+
+// Rate at which the FIFO is drained. The AHRS itself runs at the sample rate
+#define IMU_FIFO_DRAIN_FREQ_HZ 25
+
+// Online gyro bias tracking. Samples are collected in windows, and a window
+// where the gyro and accel are quiet (and the wheels are not turning) nudges
+// the offsets towards the window's mean
+#define IMU_BIAS_WINDOW_MS 500
+#define IMU_BIAS_GYRO_VAR_MAX 0.05f   // dps^2, summed over axes
+#define IMU_BIAS_ACCEL_VAR_MAX 0.0004f // g^2, summed over axes
+#define IMU_BIAS_MAX_DELTA_DPS 1.0f   // Larger shifts are treated as a slow turn
+#define IMU_BIAS_ALPHA 0.2f
+
+// Bus health. Each I2C transaction is bounded by the Wire timeout, and after
+// repeated failures (or drains that keep finding the FIFO empty) the bus is
+// cleared and the sensor re-initialized, backing off between attempts
+#define IMU_I2C_TIMEOUT_MS 10
+#define IMU_MAX_CONSECUTIVE_ERRORS 3
+#define IMU_STALE_TIMEOUT_MS 250
+#define IMU_RECOVERY_MIN_BACKOFF_MS 100
+#define IMU_RECOVERY_MAX_BACKOFF_MS 2000
+#define IMU_RECOVERY_RESET_TIMEOUT_MS 50
+
+// Window over which the AHRS timing stats are computed
+#define IMU_STATS_WINDOW_US 1000000
+
+// Updates per filter in the boot timing replay
+#define IMU_FILTER_REPLAY_SAMPLES 100
+
+// LSM6DSOX control registers, restored by the recovery
+#define LSM6DSOX_CTRL1_XL 0x10
+#define LSM6DSOX_CTRL2_G 0x11
+#define LSM6DSOX_CTRL3_C 0x12
+#define LSM6DSOX_CTRL9_XL 0x18
+
+#define LSM6DSOX_CTRL3_C_BOOT 0x80
+#define LSM6DSOX_CTRL3_C_SW_RESET 0x01
+
+// LSM6DSOX FIFO registers
+#define LSM6DSOX_FIFO_CTRL3 0x09
+#define LSM6DSOX_FIFO_CTRL4 0x0A
+#define LSM6DSOX_FIFO_STATUS1 0x3A
+#define LSM6DSOX_FIFO_DATA_OUT_TAG 0x78
+
+#define LSM6DSOX_FIFO_MODE_BYPASS 0x00
+#define LSM6DSOX_FIFO_MODE_CONTINUOUS 0x06
+
+#define LSM6DSOX_FIFO_TAG_GYRO 0x01
+#define LSM6DSOX_FIFO_TAG_ACCEL 0x02
+
+// Each FIFO word is a tag byte followed by 3x int16 (little endian)
+#define IMU_FIFO_WORD_SIZE 7
+
+// Keep a single burst within the Wire buffer
+#define IMU_FIFO_MAX_WORDS_PER_READ 36
+
+// DMA reads aren't limited by the Wire buffer. Sized to hold a full drain
+// period at the highest sample rate
+#define IMU_FIFO_ASYNC_MAX_WORDS 72
+
+// How long a blocking register access waits for an async transfer to finish
+#define IMU_ASYNC_WAIT_TIMEOUT_US 5000
 
 namespace xrp {
 
+// On-disk layout of the saved calibration
+struct ImuCalibrationData {
+  uint32_t magic;
+  uint32_t version;
+  float gyroOffsetsDPS[3];
+  float accelOffsetsG[3];
+  float temperatureC;
+  uint32_t checksum;
+};
+
+// The calibration file is only touched from core0 (LittleFS isn't safe to use
+// from both cores). It is read before the calibration is handed to core1, and
+// a new calibration is written once core1 hands back
+ImuCalibrationData _imuSavedCalibration;
+bool _imuSavedCalibrationValid = false;
+bool _imuCalibrationUnsaved = false;
+float _imuCalibrationTempC = 0;
+
+// Supported sample rates. Gyro and accel both run at the ODR, and both are
+// batched into the FIFO at the matching BDR
+struct ImuRateSetting {
+  int hz;
+  lsm6ds_data_rate_t odr;
+  uint8_t fifoBdr;
+};
+
+const ImuRateSetting _imuRateSettings[] = {
+  {26, LSM6DS_RATE_26_HZ, 0x02},
+  {52, LSM6DS_RATE_52_HZ, 0x03},
+  {104, LSM6DS_RATE_104_HZ, 0x04},
+  {208, LSM6DS_RATE_208_HZ, 0x05},
+  {416, LSM6DS_RATE_416_HZ, 0x06},
+  {833, LSM6DS_RATE_833_HZ, 0x07}
+};
+
+const ImuRateSetting *_imuRate = &_imuRateSettings[3];
+
 unsigned long _imuUpdatePeriod = 1000 / IMU_UPDATE_RATE_HZ;
 Adafruit_LSM6DSOX _lsm6;
 bool _imuReady = false;
@@ -25,7 +137,109 @@ float _gyroAnglesDeg[3] = {0, 0, 0};
 
 float _ahrsOffsets[3] = {0, 0, 0};
 
-Madgwick _ahrsFilter;
+TwoWire *_imuWire = nullptr;
+uint8_t _imuAddr = IMU_I2C_ADDR;
+
+// Raw count -> G / DPS, based on the configured ranges
+float _accelSensitivityG = 0.000061f;
+float _gyroSensitivityDPS = 0.00875f;
+
+uint8_t _fifoBuffer[IMU_FIFO_MAX_WORDS_PER_READ * IMU_FIFO_WORD_SIZE];
+float _fifoGyroRawDPS[3] = {0, 0, 0};
+float _fifoGyroDPS[3] = {0, 0, 0};
+float _fifoAccelG[3] = {0, 0, 0};
+bool _fifoGyroFresh = false;
+bool _fifoAccelFresh = false;
+
+// Sample times for the history. The FIFO words carry no timestamp, so each
+// sample is placed by how far it sat from the newest one when the FIFO status
+// was read
+uint32_t _fifoBatchStatusUs = 0;
+int _fifoBatchSamplesLeft = 0;
+
+// Bias tracking window. Values are accumulated relative to the first sample
+// of the window to keep the variance from cancelling out in float
+bool _imuMotionHint = false;
+int _biasWindowSamples = 0;
+float _biasGyroRef[3] = {0, 0, 0};
+float _biasAccelRef[3] = {0, 0, 0};
+float _biasGyroSum[3] = {0, 0, 0};
+float _biasGyroSumSq = 0;
+float _biasAccelSum[3] = {0, 0, 0};
+float _biasAccelSumSq = 0;
+bool _biasWindowValid = true;
+unsigned int _biasUpdateCount = 0;
+
+// Async FIFO reads. The status read completes in the DMA interrupt, which
+// chains the data read. The words are then processed from imuPeriodic()
+enum class FifoReadState {
+  IDLE,
+  STATUS,
+  DATA,
+  DONE
+};
+
+bool _imuUseAsync = false;
+volatile FifoReadState _fifoReadState = FifoReadState::IDLE;
+uint8_t _fifoAsyncStatus[2];
+uint8_t _fifoAsyncBuffer[IMU_FIFO_ASYNC_MAX_WORDS * IMU_FIFO_WORD_SIZE];
+volatile int _fifoAsyncWords = 0;
+volatile int _fifoAsyncStatusWords = 0;
+volatile uint32_t _fifoAsyncStatusUs = 0;
+volatile bool _fifoAsyncMore = false;
+volatile bool _fifoAsyncOverrun = false;
+volatile bool _fifoAsyncFailed = false;
+unsigned long _fifoAsyncStartCostUs = 0;
+
+// Bus health
+ImuHealth _imuHealth = ImuHealth::OFFLINE;
+int _imuConsecutiveErrors = 0;
+unsigned int _imuErrorCount = 0;
+unsigned int _imuRecoveryCount = 0;
+unsigned long _imuLastSampleMs = 0;
+bool _imuStale = false;
+unsigned long _imuNextRecoveryMs = 0;
+unsigned long _imuRecoveryBackoffMs = IMU_RECOVERY_MIN_BACKOFF_MS;
+
+// The recovery runs one step per imuPeriodic() call, so the loop keeps going
+// while the sensor resets
+enum class ImuRecoveryStep : uint8_t {
+  BUS_CLEAR,   // Let any DMA transfer finish, then free SDA and send a STOP
+  SW_RESET,
+  WAIT_RESET,
+  REBOOT,      // Reload the trimming values
+  WAIT_REBOOT,
+  CONFIGURE,   // Restore the control registers captured at init
+  FIFO_START
+};
+
+enum class ImuRecoveryResult : uint8_t {
+  PENDING,
+  DONE,
+  FAILED
+};
+
+ImuRecoveryStep _imuRecoveryStep = ImuRecoveryStep::BUS_CLEAR;
+unsigned long _imuRecoveryDeadlineMs = 0;
+
+// CTRL1_XL, CTRL2_G and CTRL3_C as set up by the driver at init, plus CTRL9_XL
+uint8_t _imuCtrlRegisters[3];
+uint8_t _imuCtrl9Register;
+bool _imuConfigured = false;
+
+// Filter sample rate, which is the nominal ODR. The INT1 line isn't routed
+// to a GPIO on the XRP boards, so the FIFO is polled on a timer and there is
+// no edge to measure the sensor's actual rate from
+float _ahrsSampleRateHz = 208;
+
+// Orientation filters. Only the selected one is updated
+MadgwickFilter _madgwickFilter;
+MadgwickFixedFilter _madgwickFixedFilter;
+MahonyFilter _mahonyFilter;
+YawOnlyFilter _yawOnlyFilter;
+OrientationFilter *_ahrsFilter = &_madgwickFilter;
+OrientationFilter *_filters[IMU_FILTER_COUNT] = {&_madgwickFilter, &_madgwickFixedFilter, &_mahonyFilter, &_yawOnlyFilter};
+unsigned long _filterCostCycles[IMU_FILTER_COUNT];
 bool _filterStarted = false;
 unsigned long _microsPerReading, _microsPrevious;
 
@@ -62,179 +276,997 @@ bool imuIsEnabled() {
   return _imuEnabled;
 }
 
-void imuInit(uint8_t addr, TwoWire *theWire) {
-  if (!_lsm6.begin_I2C(addr, theWire, 0)) {
-    Serial.println("Failed to find LSM6DSOX");
-    _imuReady = false;
+bool imuSetSampleRate(int hz) {
+  for (auto& setting : _imuRateSettings) {
+    if (setting.hz == hz) {
+      _imuRate = &setting;
+      return true;
+    }
+  }
+
+  Serial.printf("[IMU] Unsupported sample rate %d hz. Using %d hz\n", hz, _imuRate->hz);
+  return false;
+}
+
+void _imuNoteBusResult(bool ok) {
+  if (ok) {
+    _imuConsecutiveErrors = 0;
   }
   else {
-    _imuReady = true;
-    Serial.println("--- IMU ---");
-    Serial.println("LSM6DSOX detected");
-    
-    Serial.println("Setting update rate to 208Hz");
-    _lsm6.setGyroDataRate(LSM6DS_RATE_208_HZ);
-    _lsm6.setAccelDataRate(LSM6DS_RATE_208_HZ);
-
-    Serial.print("Accel Range: ");
-    switch (_lsm6.getAccelRange()) {
-      case LSM6DS_ACCEL_RANGE_2_G:
-        Serial.println("+-2G");
-        break;
-      case LSM6DS_ACCEL_RANGE_4_G:
-        Serial.println("+-4G");
-        break;
-      case LSM6DS_ACCEL_RANGE_8_G:
-        Serial.println("+-8G");
-        break;
-      case LSM6DS_ACCEL_RANGE_16_G:
-        Serial.println("+-16G");
-        break;
+    _imuConsecutiveErrors++;
+    _imuErrorCount++;
+  }
+}
+
+bool _imuWriteRegister(uint8_t reg, uint8_t value) {
+  if (_imuUseAsync && !i2cAsyncWait(IMU_ASYNC_WAIT_TIMEOUT_US)) {
+    return false;
+  }
+
+  _imuWire->beginTransmission(_imuAddr);
+  _imuWire->write(reg);
+  _imuWire->write(value);
+  bool ok = _imuWire->endTransmission() == 0;
+  _imuNoteBusResult(ok);
+  return ok;
+}
+
+bool _imuReadRegisters(uint8_t reg, uint8_t *buffer, size_t len) {
+  if (_imuUseAsync && !i2cAsyncWait(IMU_ASYNC_WAIT_TIMEOUT_US)) {
+    return false;
+  }
+
+  _imuWire->beginTransmission(_imuAddr);
+  _imuWire->write(reg);
+  if (_imuWire->endTransmission(false) != 0) {
+    _imuNoteBusResult(false);
+    return false;
+  }
+
+  if (_imuWire->requestFrom(_imuAddr, len) != len) {
+    _imuNoteBusResult(false);
+    return false;
+  }
+
+  _imuWire->readBytes(buffer, len);
+  _imuNoteBusResult(true);
+  return true;
+}
+
+bool imuSetFilter(const char *name) {
+  for (auto filter : _filters) {
+    if (strcmp(filter->name(), name) == 0) {
+      if (filter != _ahrsFilter) {
+        Serial.printf("[IMU] Switching to %s filter\n", name);
+        filter->begin(_ahrsSampleRateHz);
+        filter->reset();
+        _ahrsFilter = filter;
+        gyroReset();
+      }
+      return true;
     }
+  }
+
+  Serial.printf("[IMU] Unknown filter %s. Using %s\n", name, _ahrsFilter->name());
+  return false;
+}
+
+/**
+ * Set up the sensor once the driver has found it: the data rates, the async
+ * reads and the sensitivities. The control registers are captured here for the
+ * recovery to restore
+ */
+void _imuConfigure() {
+  Serial.println("--- IMU ---");
+  Serial.println("LSM6DSOX detected");
+
+  _imuUseAsync = i2cAsyncInit(_imuWire);
+  
+  Serial.printf("Setting update rate to %dHz\n", _imuRate->hz);
+  _lsm6.setGyroDataRate(_imuRate->odr);
+  _lsm6.setAccelDataRate(_imuRate->odr);
+
+  // Kept so that the recovery can restore the sensor without the driver
+  _imuReadRegisters(LSM6DSOX_CTRL1_XL, _imuCtrlRegisters, sizeof(_imuCtrlRegisters));
+  _imuReadRegisters(LSM6DSOX_CTRL9_XL, &_imuCtrl9Register, 1);
+  _imuConfigured = true;
+
+  Serial.print("Accel Range: ");
+  switch (_lsm6.getAccelRange()) {
+    case LSM6DS_ACCEL_RANGE_2_G:
+      _accelSensitivityG = 0.000061f;
+      Serial.println("+-2G");
+      break;
+    case LSM6DS_ACCEL_RANGE_4_G:
+      _accelSensitivityG = 0.000122f;
+      Serial.println("+-4G");
+      break;
+    case LSM6DS_ACCEL_RANGE_8_G:
+      _accelSensitivityG = 0.000244f;
+      Serial.println("+-8G");
+      break;
+    case LSM6DS_ACCEL_RANGE_16_G:
+      _accelSensitivityG = 0.000488f;
+      Serial.println("+-16G");
+      break;
+  }
 
-    Serial.print("Gyro Range: ");
-    switch(_lsm6.getGyroRange()) {
-      case LSM6DS_GYRO_RANGE_125_DPS:
-        Serial.println("125 DPS");
-        break;
-      case LSM6DS_GYRO_RANGE_250_DPS:
-        Serial.println("250 DPS");
-        break;
-      case LSM6DS_GYRO_RANGE_500_DPS:
-        Serial.println("500 DPS");
-        break;
-      case LSM6DS_GYRO_RANGE_1000_DPS:
-        Serial.println("1000 DPS");
-        break;
-      case LSM6DS_GYRO_RANGE_2000_DPS:
-        Serial.println("2000 DPS");
-        break;
-      case ISM330DHCX_GYRO_RANGE_4000_DPS:
-        break;
+  Serial.print("Gyro Range: ");
+  switch(_lsm6.getGyroRange()) {
+    case LSM6DS_GYRO_RANGE_125_DPS:
+      _gyroSensitivityDPS = 0.004375f;
+      Serial.println("125 DPS");
+      break;
+    case LSM6DS_GYRO_RANGE_250_DPS:
+      _gyroSensitivityDPS = 0.00875f;
+      Serial.println("250 DPS");
+      break;
+    case LSM6DS_GYRO_RANGE_500_DPS:
+      _gyroSensitivityDPS = 0.0175f;
+      Serial.println("500 DPS");
+      break;
+    case LSM6DS_GYRO_RANGE_1000_DPS:
+      _gyroSensitivityDPS = 0.035f;
+      Serial.println("1000 DPS");
+      break;
+    case LSM6DS_GYRO_RANGE_2000_DPS:
+      _gyroSensitivityDPS = 0.07f;
+      Serial.println("2000 DPS");
+      break;
+    case ISM330DHCX_GYRO_RANGE_4000_DPS:
+      _gyroSensitivityDPS = 0.14f;
+      break;
+  }
+}
+
+/**
+ * Time an update of every filter on the same fixed replay, a 90 deg/s turn
+ * while rocking. The running figure in ImuStats only covers the active filter.
+ * Doesn't need the sensor, and each filter is reset afterwards
+ */
+void _imuTimeFilters() {
+  Serial.print("[IMU] Filter cost (cycles/update):");
+  for (int f = 0; f < IMU_FILTER_COUNT; f++) {
+    OrientationFilter *filter = _filters[f];
+    filter->begin(_imuRate->hz);
+    filter->reset();
+
+    uint32_t cycles = 0;
+    for (int i = 0; i <= IMU_FILTER_REPLAY_SAMPLES; i++) {
+      float gx = 20.0f * sinf(i * 0.1f);
+      float gy = 10.0f * cosf(i * 0.07f);
+      float ax = 0.05f * sinf(i * 0.1f);
+
+      uint32_t updateStart = rp2040.getCycleCount();
+      filter->updateIMU(gx, gy, 90.0f, ax, 0.03f, 0.99f);
+      uint32_t updateCycles = rp2040.getCycleCount() - updateStart;
+
+      // The first update pulls the code into the XIP cache, so it isn't counted
+      if (i > 0) {
+        cycles += updateCycles;
+      }
     }
+
+    _filterCostCycles[f] = cycles / IMU_FILTER_REPLAY_SAMPLES;
+    filter->reset();
+    Serial.printf(" %s %lu", filter->name(), _filterCostCycles[f]);
   }
+  Serial.println();
 }
 
-void imuCalibrate(unsigned long calibrationTimeMs) {
-  unsigned long loopDelayTime = 1000 / 208;
+void imuInit(uint8_t addr, TwoWire *theWire) {
+  _imuTimeFilters();
 
-  if (calibrationTimeMs == 0) {
-    calibrationTimeMs = IMU_DEFAULT_CALIBRATION_TIME_MS;
+  _imuWire = theWire;
+  _imuAddr = addr;
+
+  // Bound every transaction, and reset the block if one times out
+  theWire->setTimeout(IMU_I2C_TIMEOUT_MS, true);
+
+  if (!_lsm6.begin_I2C(addr, theWire, 0)) {
+    // Often a sensor left mid transaction by a reset, which holds SDA low.
+    // imuPeriodic() keeps trying it through the recovery, with its backoff
+    Serial.println("Failed to find LSM6DSOX. Retrying in the background");
+    _imuReady = false;
+    _imuRecoveryStep = ImuRecoveryStep::BUS_CLEAR;
+    _imuNextRecoveryMs = millis() + IMU_RECOVERY_MIN_BACKOFF_MS;
+    _imuRecoveryBackoffMs = IMU_RECOVERY_MIN_BACKOFF_MS;
+    return;
   }
 
-  Serial.printf("[IMU] Beginning calibration. Running for %u ms\n", calibrationTimeMs);
-  
-  float gyroAvgValues[3] = {0, 0, 0};
-  float accelAvgValues[3] = {0, 0, 0};
+  _imuConfigure();
+  _imuReady = true;
+  _imuHealth = ImuHealth::OK;
+}
 
+// Average the gyro, accel and temperature over the given time. Returns the
+// number of samples taken
+int _imuCollectAverages(unsigned long durationMs, float gyroAvg[3], float accelAvg[3], float *tempAvg, float *gyroVar) {
+  // Every read would time out, and average to offsets that don't mean anything
+  if (!_imuReady) return 0;
+
+  unsigned long loopDelayTime = 1000 / _imuRate->hz;
+
+  float gyroSumSq = 0;
+  float tempSum = 0;
   int numVals = 0;
 
-  bool ledBlinkState = true;
+  for (int i = 0; i < 3; i++) {
+    gyroAvg[i] = 0;
+    accelAvg[i] = 0;
+  }
 
   unsigned long startTime = millis();
-  unsigned long lastBlinkTime = startTime;
-
-  digitalWrite(LED_BUILTIN, HIGH);
-  while (millis() < startTime + calibrationTimeMs) {
-    // Handle the blink (the delay at the end of this loop is much
-    // smaller than what we can visually see anyway)
-    if (millis() - lastBlinkTime > 100) {
-      ledBlinkState = !ledBlinkState;
-      digitalWrite(LED_BUILTIN, ledBlinkState ? HIGH : LOW);
-      lastBlinkTime = millis();
-    }
 
+  while (millis() < startTime + durationMs) {
     // Get IMU data
     sensors_event_t accel;
     sensors_event_t gyro;
     sensors_event_t temp;
 
     _lsm6.getEvent(&accel, &gyro, &temp);
-    
+
+    float gyroDPS[3] = {
+      _radToDeg(gyro.gyro.x),
+      _radToDeg(gyro.gyro.y),
+      _radToDeg(gyro.gyro.z)
+    };
+
     // Accelerometer averages
-    accelAvgValues[0] += _accelToG(accel.acceleration.x);
-    accelAvgValues[1] += _accelToG(accel.acceleration.y);
-    accelAvgValues[2] += _accelToG(accel.acceleration.z);
+    accelAvg[0] += _accelToG(accel.acceleration.x);
+    accelAvg[1] += _accelToG(accel.acceleration.y);
+    accelAvg[2] += _accelToG(accel.acceleration.z);
 
     // Gyro averages
-    gyroAvgValues[0] += _radToDeg(gyro.gyro.x);
-    gyroAvgValues[1] += _radToDeg(gyro.gyro.y);
-    gyroAvgValues[2] += _radToDeg(gyro.gyro.z);
+    for (int i = 0; i < 3; i++) {
+      gyroAvg[i] += gyroDPS[i];
+      gyroSumSq += gyroDPS[i] * gyroDPS[i];
+    }
+
+    tempSum += temp.temperature;
 
     numVals++;
     delay(loopDelayTime);
   }
 
-  _accelOffsetsG[0] = accelAvgValues[0] / numVals;
-  _accelOffsetsG[1] = accelAvgValues[1] / numVals;
-  _accelOffsetsG[2] = accelAvgValues[2] / numVals;
+  if (numVals == 0) return 0;
+
+  // Variance is summed over the three axes
+  *gyroVar = gyroSumSq / numVals;
+  for (int i = 0; i < 3; i++) {
+    gyroAvg[i] /= numVals;
+    accelAvg[i] /= numVals;
+    *gyroVar -= gyroAvg[i] * gyroAvg[i];
+  }
+  *tempAvg = tempSum / numVals;
+
+  return numVals;
+}
 
-  _gyroOffsetsDPS[0] = gyroAvgValues[0] / numVals;
-  _gyroOffsetsDPS[1] = gyroAvgValues[1] / numVals;
-  _gyroOffsetsDPS[2] = gyroAvgValues[2] / numVals;
+uint32_t _imuCalibrationChecksum(const ImuCalibrationData &data) {
+  // FNV-1a over everything before the checksum field
+  const uint8_t *bytes = reinterpret_cast<const uint8_t*>(&data);
+  uint32_t hash = 2166136261u;
+  for (size_t i = 0; i < offsetof(ImuCalibrationData, checksum); i++) {
+    hash = (hash ^ bytes[i]) * 16777619u;
+  }
+  return hash;
+}
+
+void imuSaveCalibration() {
+  if (!_imuCalibrationUnsaved) {
+    return;
+  }
+  _imuCalibrationUnsaved = false;
+
+  ImuCalibrationData data;
+  memset(&data, 0, sizeof(data));
+  data.magic = IMU_CALIBRATION_MAGIC;
+  data.version = IMU_CALIBRATION_VERSION;
+  memcpy(data.gyroOffsetsDPS, _gyroOffsetsDPS, sizeof(data.gyroOffsetsDPS));
+  memcpy(data.accelOffsetsG, _accelOffsetsG, sizeof(data.accelOffsetsG));
+  data.temperatureC = _imuCalibrationTempC;
+  data.checksum = _imuCalibrationChecksum(data);
+
+  File f = LittleFS.open(IMU_CALIBRATION_FILE, "w");
+  if (!f) {
+    Serial.println("[IMU] Failed to open calibration file for writing");
+    return;
+  }
+  f.write(reinterpret_cast<const uint8_t*>(&data), sizeof(data));
+  f.close();
+  Serial.println("[IMU] Calibration saved");
+}
+
+void imuCalibrate(unsigned long calibrationTimeMs) {
+  if (calibrationTimeMs == 0) {
+    calibrationTimeMs = IMU_DEFAULT_CALIBRATION_TIME_MS;
+  }
+
+  Serial.printf("[IMU] Beginning calibration. Running for %u ms\n", calibrationTimeMs);
+
+  float gyroAvgValues[3];
+  float accelAvgValues[3];
+  float tempC = 0;
+  float gyroVar = 0;
+
+  if (_imuCollectAverages(calibrationTimeMs, gyroAvgValues, accelAvgValues, &tempC, &gyroVar) == 0) {
+    Serial.println("[IMU] No samples collected during calibration");
+    return;
+  }
+
+  memcpy(_accelOffsetsG, accelAvgValues, sizeof(_accelOffsetsG));
+  memcpy(_gyroOffsetsDPS, gyroAvgValues, sizeof(_gyroOffsetsDPS));
+  _biasWindowSamples = 0;
+  _biasUpdateCount = 0;
 
   // Remove 1G from the vertical axis (assumed to be Z)
   _accelOffsetsG[2] -= 1.0;
 
-  Serial.printf("[IMU] Gyro Offsets(dps): X(%f) Y(%f) Z(%f), Accel Offsets(g): X(%f) Y(%f) Z(%f)\n",
+  Serial.printf("[IMU] Gyro Offsets(dps): X(%f) Y(%f) Z(%f), Accel Offsets(g): X(%f) Y(%f) Z(%f), Temp(C): %.1f\n",
       _gyroOffsetsDPS[0],
       _gyroOffsetsDPS[1],
       _gyroOffsetsDPS[2],
       _accelOffsetsG[0],
       _accelOffsetsG[1],
-      _accelOffsetsG[2]);
+      _accelOffsetsG[2],
+      tempC);
   Serial.println("[IMU] Calibration Complete");
 
-  digitalWrite(LED_BUILTIN, LOW);
+  _imuCalibrationTempC = tempC;
+  _imuCalibrationUnsaved = true;
+}
+
+bool imuReadSavedCalibration() {
+  _imuSavedCalibrationValid = false;
+
+  File f = LittleFS.open(IMU_CALIBRATION_FILE, "r");
+  if (!f) {
+    Serial.println("[IMU] No saved calibration");
+    return false;
+  }
+
+  ImuCalibrationData &data = _imuSavedCalibration;
+  size_t n = f.read(reinterpret_cast<uint8_t*>(&data), sizeof(data));
+  f.close();
+
+  if (n != sizeof(data) ||
+      data.magic != IMU_CALIBRATION_MAGIC ||
+      data.version != IMU_CALIBRATION_VERSION ||
+      data.checksum != _imuCalibrationChecksum(data)) {
+    Serial.println("[IMU] Saved calibration is invalid");
+    return false;
+  }
+
+  _imuSavedCalibrationValid = true;
+  return true;
+}
+
+bool imuLoadCalibration() {
+  if (!_imuSavedCalibrationValid) {
+    return false;
+  }
+  const ImuCalibrationData &data = _imuSavedCalibration;
+
+  // Quick sanity check that the robot is sitting still, and that the saved
+  // offsets still describe this sensor at its current temperature
+  float gyroAvg[3];
+  float accelAvg[3];
+  float tempC = 0;
+  float gyroVar = 0;
+
+  if (_imuCollectAverages(IMU_CALIBRATION_CHECK_TIME_MS, gyroAvg, accelAvg, &tempC, &gyroVar) == 0) {
+    return false;
+  }
+
+  if (fabs(tempC - data.temperatureC) > IMU_CALIBRATION_MAX_TEMP_DELTA_C) {
+    Serial.printf("[IMU] Saved calibration rejected: temperature %.1fC vs %.1fC\n", tempC, data.temperatureC);
+    return false;
+  }
+
+  if (gyroVar > IMU_BIAS_GYRO_VAR_MAX) {
+    Serial.printf("[IMU] Saved calibration rejected: gyro not still (var %.3f)\n", gyroVar);
+    return false;
+  }
+
+  float expectedAccel[3] = {data.accelOffsetsG[0], data.accelOffsetsG[1], data.accelOffsetsG[2] + 1.0f};
+  for (int i = 0; i < 3; i++) {
+    if (fabs(gyroAvg[i] - data.gyroOffsetsDPS[i]) > IMU_CALIBRATION_MAX_GYRO_DELTA_DPS ||
+        fabs(accelAvg[i] - expectedAccel[i]) > IMU_CALIBRATION_MAX_ACCEL_DELTA_G) {
+      Serial.printf("[IMU] Saved calibration rejected: axis %d out of range\n", i);
+      return false;
+    }
+  }
+
+  // The short average is a fresher gyro bias estimate than the saved one.
+  // The accel offsets need the longer average, so keep the saved values
+  memcpy(_gyroOffsetsDPS, gyroAvg, sizeof(_gyroOffsetsDPS));
+  memcpy(_accelOffsetsG, data.accelOffsetsG, sizeof(_accelOffsetsG));
+  _biasWindowSamples = 0;
+  _biasUpdateCount = 0;
+
+  Serial.printf("[IMU] Using saved calibration. Gyro Offsets(dps): X(%f) Y(%f) Z(%f), Temp(C): %.1f\n",
+      _gyroOffsetsDPS[0],
+      _gyroOffsetsDPS[1],
+      _gyroOffsetsDPS[2],
+      tempC);
+  return true;
+}
+
+// AHRS timing stats
+unsigned int _imuSampleCount = 0;
+uint32_t _ahrsUpdateCycles = 0;
+unsigned long _imuDrainTimeUs = 0;
+unsigned int _imuDrainCount = 0;
+unsigned long _statsWindowStartUs = 0;
+unsigned int _statsWindowSamples = 0;
+ImuStats _imuStats = {"", 0, 0, 0, 0, 0, 0};
+
+bool _imuFifoStart() {
+  // Going through bypass mode clears anything left over from calibration
+  bool ok = _imuWriteRegister(LSM6DSOX_FIFO_CTRL4, LSM6DSOX_FIFO_MODE_BYPASS) &&
+      _imuWriteRegister(LSM6DSOX_FIFO_CTRL3, (_imuRate->fifoBdr << 4) | _imuRate->fifoBdr) &&
+      _imuWriteRegister(LSM6DSOX_FIFO_CTRL4, LSM6DSOX_FIFO_MODE_CONTINUOUS);
+
+  _fifoGyroFresh = false;
+  _fifoAccelFresh = false;
+  return ok;
+}
+
+void _imuResetBiasWindow() {
+  _biasWindowSamples = 0;
+  _biasGyroSumSq = 0;
+  _biasAccelSumSq = 0;
+  for (int i = 0; i < 3; i++) {
+    _biasGyroSum[i] = 0;
+    _biasAccelSum[i] = 0;
+  }
+  _biasWindowValid = true;
+}
+
+/**
+ * Feed the latest gyro/accel pair into the stationary detector, and update the
+ * gyro offsets at the end of each quiet window
+ */
+void _imuTrackBias() {
+  if (_biasWindowSamples == 0) {
+    _imuResetBiasWindow();
+    memcpy(_biasGyroRef, _fifoGyroRawDPS, sizeof(_biasGyroRef));
+    memcpy(_biasAccelRef, _fifoAccelG, sizeof(_biasAccelRef));
+  }
+
+  if (_imuMotionHint) {
+    _biasWindowValid = false;
+  }
+
+  for (int i = 0; i < 3; i++) {
+    float dg = _fifoGyroRawDPS[i] - _biasGyroRef[i];
+    float da = _fifoAccelG[i] - _biasAccelRef[i];
+    _biasGyroSum[i] += dg;
+    _biasGyroSumSq += dg * dg;
+    _biasAccelSum[i] += da;
+    _biasAccelSumSq += da * da;
+  }
+  _biasWindowSamples++;
+
+  if (_biasWindowSamples < (_imuRate->hz * IMU_BIAS_WINDOW_MS) / 1000) return;
+
+  float n = _biasWindowSamples;
+  float gyroVar = _biasGyroSumSq / n;
+  float accelVar = _biasAccelSumSq / n;
+  float gyroMean[3];
+  for (int i = 0; i < 3; i++) {
+    float gm = _biasGyroSum[i] / n;
+    float am = _biasAccelSum[i] / n;
+    gyroVar -= gm * gm;
+    accelVar -= am * am;
+    gyroMean[i] = _biasGyroRef[i] + gm;
+  }
+
+  bool stationary = _biasWindowValid &&
+                    gyroVar < IMU_BIAS_GYRO_VAR_MAX &&
+                    accelVar < IMU_BIAS_ACCEL_VAR_MAX;
+
+  for (int i = 0; i < 3 && stationary; i++) {
+    if (fabs(gyroMean[i] - _gyroOffsetsDPS[i]) > IMU_BIAS_MAX_DELTA_DPS) {
+      stationary = false;
+    }
+  }
+
+  if (stationary) {
+    for (int i = 0; i < 3; i++) {
+      _gyroOffsetsDPS[i] += IMU_BIAS_ALPHA * (gyroMean[i] - _gyroOffsetsDPS[i]);
+    }
+    _biasUpdateCount++;
+  }
+
+  _biasWindowSamples = 0;
+}
+
+/**
+ * Start placing the samples of a FIFO read in time. numWords is the FIFO level
+ * at the status read, including words this read may leave for the next one
+ */
+void _imuBeginFifoBatch(uint32_t statusUs, int numWords) {
+  _fifoBatchStatusUs = statusUs;
+  _fifoBatchSamplesLeft = numWords / 2;
+}
+
+/**
+ * Record the latest filtered sample into the history, at most once per record
+ * period
+ */
+void _imuRecordHistory() {
+  if (_fifoBatchSamplesLeft > 0) {
+    _fifoBatchSamplesLeft--;
+  }
+  uint32_t sampleUs = _fifoBatchStatusUs - _fifoBatchSamplesLeft * (1000000 / _imuRate->hz);
+
+  if (!historyRecordDue(HistorySensor::GYRO_RATE, sampleUs)) return;
+
+  float angles[3] = {imuGetRoll(), imuGetPitch(), imuGetYaw()};
+  historyRecord(HistorySensor::GYRO_RATE, sampleUs, _gyroRatesDPS);
+  historyRecord(HistorySensor::GYRO_ANGLE, sampleUs, angles);
+  historyRecord(HistorySensor::ACCEL, sampleUs, _accelG);
+}
+
+void _imuProcessFifoWord(uint8_t *word) {
+  uint8_t tag = word[0] >> 3;
+  int16_t raw[3] = {
+    (int16_t)(word[1] | (word[2] << 8)),
+    (int16_t)(word[3] | (word[4] << 8)),
+    (int16_t)(word[5] | (word[6] << 8))
+  };
+
+  switch (tag) {
+    case LSM6DSOX_FIFO_TAG_GYRO:
+      for (int i = 0; i < 3; i++) {
+        _fifoGyroRawDPS[i] = raw[i] * _gyroSensitivityDPS;
+        _fifoGyroDPS[i] = _fifoGyroRawDPS[i] - _gyroOffsetsDPS[i];
+      }
+      _fifoGyroFresh = true;
+      break;
+    case LSM6DSOX_FIFO_TAG_ACCEL:
+      for (int i = 0; i < 3; i++) {
+        _fifoAccelG[i] = (raw[i] * _accelSensitivityG) - _accelOffsetsG[i];
+      }
+      _fifoAccelFresh = true;
+      break;
+    default:
+      return;
+  }
+
+  // Gyro and accel are batched at the same rate, so every pair is one sample
+  // period apart and the filter's fixed dt is correct
+  if (_fifoGyroFresh && _fifoAccelFresh) {
+    uint32_t updateStart = rp2040.getCycleCount();
+    _ahrsFilter->updateIMU(_fifoGyroDPS[0], _fifoGyroDPS[1], _fifoGyroDPS[2], _fifoAccelG[0], _fifoAccelG[1], _fifoAccelG[2]);
+    _ahrsUpdateCycles += rp2040.getCycleCount() - updateStart;
+
+    memcpy(_gyroRatesDPS, _fifoGyroDPS, sizeof(_gyroRatesDPS));
+    memcpy(_accelG, _fifoAccelG, sizeof(_accelG));
+
+    _fifoGyroFresh = false;
+    _fifoAccelFresh = false;
+    _imuRecordHistory();
+    _imuTrackBias();
+    _imuSampleCount++;
+    _statsWindowSamples++;
+  }
+}
+
+/**
+ * Read everything currently in the FIFO and run it through the filter
+ *
+ * @return Number of FIFO words read
+ */
+int _imuFifoDrain() {
+  uint8_t status[2];
+  if (!_imuReadRegisters(LSM6DSOX_FIFO_STATUS1, status, 2)) {
+    return 0;
+  }
+
+  // FIFO_STATUS2 holds the overrun flag and the top 2 bits of the word count
+  int numWords = status[0] | ((status[1] & 0x03) << 8);
+  if (status[1] & 0x40) {
+    Serial.println("[IMU] FIFO overrun");
+  }
+  _imuBeginFifoBatch(micros(), numWords);
+
+  int wordsRead = 0;
+  while (wordsRead < numWords) {
+    int burstWords = min(numWords - wordsRead, IMU_FIFO_MAX_WORDS_PER_READ);
+
+    // The output address rolls back to the TAG register after each word, so a
+    // single burst reads multiple words
+    if (!_imuReadRegisters(LSM6DSOX_FIFO_DATA_OUT_TAG, _fifoBuffer, burstWords * IMU_FIFO_WORD_SIZE)) {
+      break;
+    }
+
+    for (int i = 0; i < burstWords; i++) {
+      _imuProcessFifoWord(&_fifoBuffer[i * IMU_FIFO_WORD_SIZE]);
+    }
+    wordsRead += burstWords;
+  }
+
+  return wordsRead;
+}
+
+/**
+ * Track when a drain last returned samples. Staleness is only judged when a
+ * drain comes back empty: a stalled loop leaves the samples waiting in the
+ * FIFO, and that shouldn't look like a dead sensor
+ */
+void _imuNoteDrain(int words) {
+  unsigned long now = millis();
+  if (words > 0) {
+    _imuLastSampleMs = now;
+    _imuStale = false;
+  }
+  else {
+    _imuStale = now - _imuLastSampleMs > IMU_STALE_TIMEOUT_MS;
+  }
+}
+
+/**
+ * Completion callback for the async FIFO reads. Runs in interrupt context
+ */
+void _imuFifoAsyncComplete(bool success, void *context) {
+  if (!success) {
+    _fifoAsyncFailed = true;
+    _fifoAsyncWords = 0;
+    _fifoReadState = FifoReadState::DONE;
+    return;
+  }
+
+  if (_fifoReadState == FifoReadState::STATUS) {
+    int numWords = _fifoAsyncStatus[0] | ((_fifoAsyncStatus[1] & 0x03) << 8);
+    _fifoAsyncStatusUs = micros();
+    _fifoAsyncStatusWords = numWords;
+    if (_fifoAsyncStatus[1] & 0x40) {
+      _fifoAsyncOverrun = true;
+    }
+
+    int words = min(numWords, IMU_FIFO_ASYNC_MAX_WORDS);
+    _fifoAsyncMore = numWords > words;
+    _fifoAsyncWords = words;
+
+    if (words > 0 &&
+        i2cAsyncReadRegisters(_imuAddr, LSM6DSOX_FIFO_DATA_OUT_TAG, _fifoAsyncBuffer,
+                              words * IMU_FIFO_WORD_SIZE, _imuFifoAsyncComplete, nullptr)) {
+      _fifoReadState = FifoReadState::DATA;
+    }
+    else {
+      _fifoAsyncWords = 0;
+      _fifoReadState = FifoReadState::DONE;
+    }
+  }
+  else {
+    _fifoReadState = FifoReadState::DONE;
+  }
+}
+
+bool _imuFifoStartAsyncRead() {
+  _fifoAsyncFailed = false;
+  _fifoReadState = FifoReadState::STATUS;
+  if (!i2cAsyncReadRegisters(_imuAddr, LSM6DSOX_FIFO_STATUS1, _fifoAsyncStatus, 2, _imuFifoAsyncComplete, nullptr)) {
+    _fifoReadState = FifoReadState::IDLE;
+    return false;
+  }
+  return true;
+}
+
+/**
+ * Run the words from a completed async read through the filter
+ */
+void _imuFifoAsyncProcess() {
+  unsigned long processStart = micros();
+
+  if (_fifoAsyncOverrun) {
+    _fifoAsyncOverrun = false;
+    Serial.println("[IMU] FIFO overrun");
+  }
+
+  _imuNoteBusResult(!_fifoAsyncFailed);
+  _fifoAsyncFailed = false;
+
+  _imuBeginFifoBatch(_fifoAsyncStatusUs, _fifoAsyncStatusWords);
+  for (int i = 0; i < _fifoAsyncWords; i++) {
+    _imuProcessFifoWord(&_fifoAsyncBuffer[i * IMU_FIFO_WORD_SIZE]);
+  }
+  _imuNoteDrain(_fifoAsyncWords);
+
+  _imuDrainTimeUs += _fifoAsyncStartCostUs + (micros() - processStart);
+  _imuDrainCount++;
+
+  _fifoReadState = FifoReadState::IDLE;
+}
+
+/**
+ * Release a target that is holding SDA low (i.e. reset mid-transfer by a
+ * brownout) by clocking SCL by hand, then send a STOP
+ */
+void _imuBusClear() {
+  _imuWire->end();
+
+  // Open drain: release lets the pull-up take the line high
+  auto release = [](int pin) { pinMode(pin, INPUT_PULLUP); };
+  auto driveLow = [](int pin) { pinMode(pin, OUTPUT); digitalWrite(pin, LOW); };
+
+  release(I2C_SDA_1);
+  release(I2C_SCL_1);
+  delayMicroseconds(5);
+
+  for (int i = 0; i < 9 && digitalRead(I2C_SDA_1) == LOW; i++) {
+    driveLow(I2C_SCL_1);
+    delayMicroseconds(5);
+    release(I2C_SCL_1);
+    delayMicroseconds(5);
+  }
+
+  // STOP: SDA rises while SCL is high
+  driveLow(I2C_SCL_1);
+  delayMicroseconds(5);
+  driveLow(I2C_SDA_1);
+  delayMicroseconds(5);
+  release(I2C_SCL_1);
+  delayMicroseconds(5);
+  release(I2C_SDA_1);
+  delayMicroseconds(5);
+
+  _imuWire->begin();
 }
 
-unsigned long _imuLoopTime = 0;
-int _imuLoopCount = 0;
+/**
+ * Run the next step of the recovery: clear the bus, reset and reboot the
+ * sensor, then restore its registers. Each step is one or a few register
+ * accesses bounded by the Wire timeout, and the resets are polled against a
+ * deadline instead of waited on
+ */
+ImuRecoveryResult _imuRecoverStep() {
+  switch (_imuRecoveryStep) {
+    case ImuRecoveryStep::BUS_CLEAR:
+      // i2cAsyncPoll() fails a stuck transfer once it passes its deadline
+      if (_imuUseAsync && i2cAsyncBusy()) {
+        i2cAsyncPoll();
+        return ImuRecoveryResult::PENDING;
+      }
+
+      Serial.println("[IMU] Attempting recovery");
+      _imuRecoveryCount++;
+      _fifoReadState = FifoReadState::IDLE;
+      _fifoAsyncMore = false;
+
+      _imuBusClear();
+      _imuRecoveryStep = ImuRecoveryStep::SW_RESET;
+      return ImuRecoveryResult::PENDING;
+
+    case ImuRecoveryStep::SW_RESET:
+    case ImuRecoveryStep::REBOOT: {
+      bool reboot = _imuRecoveryStep == ImuRecoveryStep::REBOOT;
+      if (!_imuWriteRegister(LSM6DSOX_CTRL3_C, reboot ? LSM6DSOX_CTRL3_C_BOOT : LSM6DSOX_CTRL3_C_SW_RESET)) {
+        Serial.println("[IMU] Recovery failed: LSM6DSOX not responding");
+        return ImuRecoveryResult::FAILED;
+      }
+      _imuRecoveryDeadlineMs = millis() + IMU_RECOVERY_RESET_TIMEOUT_MS;
+      _imuRecoveryStep = reboot ? ImuRecoveryStep::WAIT_REBOOT : ImuRecoveryStep::WAIT_RESET;
+      return ImuRecoveryResult::PENDING;
+    }
+
+    case ImuRecoveryStep::WAIT_RESET:
+    case ImuRecoveryStep::WAIT_REBOOT: {
+      // The bit clears itself once the sensor is done. It may not answer until then
+      bool reboot = _imuRecoveryStep == ImuRecoveryStep::WAIT_REBOOT;
+      uint8_t busyBit = reboot ? LSM6DSOX_CTRL3_C_BOOT : LSM6DSOX_CTRL3_C_SW_RESET;
+      uint8_t ctrl3;
+      if (_imuReadRegisters(LSM6DSOX_CTRL3_C, &ctrl3, 1) && !(ctrl3 & busyBit)) {
+        _imuRecoveryStep = reboot ? ImuRecoveryStep::CONFIGURE : ImuRecoveryStep::REBOOT;
+        return ImuRecoveryResult::PENDING;
+      }
+      if ((long)(millis() - _imuRecoveryDeadlineMs) >= 0) {
+        Serial.printf("[IMU] Recovery failed: %s did not complete\n", reboot ? "reboot" : "reset");
+        return ImuRecoveryResult::FAILED;
+      }
+      return ImuRecoveryResult::PENDING;
+    }
+
+    case ImuRecoveryStep::CONFIGURE: {
+      // A sensor that wasn't found at boot has nothing captured to restore,
+      // so the driver sets it up the first time. This blocks for the few ms
+      // of the driver's own reset, once
+      if (!_imuConfigured) {
+        if (!_lsm6.begin_I2C(_imuAddr, _imuWire, 0)) {
+          Serial.println("[IMU] Recovery failed: LSM6DSOX not found");
+          return ImuRecoveryResult::FAILED;
+        }
+        _imuConfigure();
+        _imuRecoveryStep = ImuRecoveryStep::FIFO_START;
+        return ImuRecoveryResult::PENDING;
+      }
+
+      bool ok = true;
+      for (size_t i = 0; i < sizeof(_imuCtrlRegisters) && ok; i++) {
+        ok = _imuWriteRegister(LSM6DSOX_CTRL1_XL + i, _imuCtrlRegisters[i]);
+      }
+      if (!ok || !_imuWriteRegister(LSM6DSOX_CTRL9_XL, _imuCtrl9Register)) {
+        Serial.println("[IMU] Recovery failed: could not restore the configuration");
+        return ImuRecoveryResult::FAILED;
+      }
+      _imuRecoveryStep = ImuRecoveryStep::FIFO_START;
+      return ImuRecoveryResult::PENDING;
+    }
+
+    case ImuRecoveryStep::FIFO_START:
+      if (!_imuFifoStart()) {
+        Serial.println("[IMU] Recovery failed: could not start the FIFO");
+        return ImuRecoveryResult::FAILED;
+      }
+      Serial.println("[IMU] Recovered");
+      return ImuRecoveryResult::DONE;
+  }
+
+  return ImuRecoveryResult::FAILED;
+}
+
+// Start over from the bus clear once the backoff has passed, doubling it each time
+void _imuRecoveryBackOff() {
+  _imuRecoveryStep = ImuRecoveryStep::BUS_CLEAR;
+  _imuNextRecoveryMs = millis() + _imuRecoveryBackoffMs;
+  _imuRecoveryBackoffMs = min(_imuRecoveryBackoffMs * 2, (unsigned long)IMU_RECOVERY_MAX_BACKOFF_MS);
+}
+
+/**
+ * Track the bus health and run the recovery (rate limited) when the sensor
+ * stops responding or stops producing samples
+ */
+void _imuCheckHealth() {
+  unsigned long now = millis();
+
+  if (_imuHealth != ImuHealth::RECOVERING) {
+    if (_imuConsecutiveErrors >= IMU_MAX_CONSECUTIVE_ERRORS || _imuStale) {
+      Serial.printf("[IMU] Unhealthy (%d errors, last sample %lu ms ago)\n",
+          _imuConsecutiveErrors, now - _imuLastSampleMs);
+      _imuHealth = ImuHealth::RECOVERING;
+      _imuRecoveryStep = ImuRecoveryStep::BUS_CLEAR;
+      _imuNextRecoveryMs = now;
+      _imuRecoveryBackoffMs = IMU_RECOVERY_MIN_BACKOFF_MS;
+    }
+    else {
+      _imuHealth = _imuConsecutiveErrors > 0 ? ImuHealth::DEGRADED : ImuHealth::OK;
+      return;
+    }
+  }
+
+  if ((long)(now - _imuNextRecoveryMs) < 0) return;
+
+  ImuRecoveryResult result = _imuRecoverStep();
+  if (result == ImuRecoveryResult::DONE) {
+    _imuHealth = ImuHealth::OK;
+    _imuConsecutiveErrors = 0;
+    _imuLastSampleMs = millis();
+    _imuStale = false;
+    _microsPrevious = micros();
+  }
+  else if (result == ImuRecoveryResult::FAILED) {
+    _imuRecoveryBackOff();
+  }
+}
+
+/**
+ * Bring up a sensor that wasn't found at boot, through the same recovery steps
+ * and backoff as a failure in use. The health stays OFFLINE until it answers
+ */
+void _imuBringUp() {
+  if ((long)(millis() - _imuNextRecoveryMs) < 0) return;
+
+  ImuRecoveryResult result = _imuRecoverStep();
+  if (result == ImuRecoveryResult::DONE) {
+    // The boot calibration had no samples. The saved one can't be checked
+    // without blocking the loop, so it is taken as it is, and the bias
+    // tracking corrects the gyro once the robot is still
+    if (_imuSavedCalibrationValid) {
+      memcpy(_gyroOffsetsDPS, _imuSavedCalibration.gyroOffsetsDPS, sizeof(_gyroOffsetsDPS));
+      memcpy(_accelOffsetsG, _imuSavedCalibration.accelOffsetsG, sizeof(_accelOffsetsG));
+      Serial.println("[IMU] LSM6DSOX came up after boot. Using the saved calibration unchecked");
+    }
+    else {
+      Serial.println("[IMU] LSM6DSOX came up after boot. Running uncalibrated");
+    }
+    _imuReady = true;
+    _imuHealth = ImuHealth::OK;
+    _imuConsecutiveErrors = 0;
+  }
+  else if (result == ImuRecoveryResult::FAILED) {
+    _imuRecoveryBackOff();
+  }
+}
+
+/**
+ * Roll the timing stats over once per window
+ */
+void _imuUpdateStats(unsigned long microsNow) {
+  unsigned long windowUs = microsNow - _statsWindowStartUs;
+  if (windowUs < IMU_STATS_WINDOW_US) return;
+
+  _imuStats.filterName = _ahrsFilter->name();
+  _imuStats.sampleRateHz = _imuRate->hz;
+  _imuStats.updateRateHz = (_statsWindowSamples * 1000000.0f) / windowUs;
+  _imuStats.avgUpdateCycles = _statsWindowSamples > 0 ? _ahrsUpdateCycles / _statsWindowSamples : 0;
+  _imuStats.avgUpdateUs = _imuStats.avgUpdateCycles / (F_CPU / 1000000);
+  _imuStats.avgDrainUs = _imuDrainCount > 0 ? _imuDrainTimeUs / _imuDrainCount : 0;
+  _imuStats.cpuLoadPct = (_imuDrainTimeUs * 100.0f) / windowUs;
+
+  _ahrsUpdateCycles = 0;
+  _imuDrainTimeUs = 0;
+  _imuDrainCount = 0;
+  _statsWindowSamples = 0;
+  _statsWindowStartUs = microsNow;
+}
 
 void imuPeriodic() {
+  if (!_imuReady) {
+    _imuBringUp();
+    return;
+  }
+
   // Initialize the filter if this is the first time we are running through the periodic
   if (!_filterStarted) {
-    Serial.printf("[IMU] Starting Madgwick filter at %u hz\n", IMU_MADGWICK_LOOP_FREQ_HZ);
-    _microsPerReading = 1000000 / IMU_MADGWICK_LOOP_FREQ_HZ;
+    Serial.printf("[IMU] Starting %s filter at %u hz, draining FIFO at %u hz\n", _ahrsFilter->name(), _imuRate->hz, IMU_FIFO_DRAIN_FREQ_HZ);
+    _microsPerReading = 1000000 / IMU_FIFO_DRAIN_FREQ_HZ;
     _microsPrevious = micros();
-    _ahrsFilter.begin(IMU_MADGWICK_LOOP_FREQ_HZ);
+    _statsWindowStartUs = _microsPrevious;
+    _ahrsSampleRateHz = _imuRate->hz;
+    _ahrsFilter->begin(_ahrsSampleRateHz);
+    _imuFifoStart();
+    _imuLastSampleMs = millis();
     _filterStarted = true;
     return;
   }
 
+  _imuCheckHealth();
+  if (_imuHealth == ImuHealth::RECOVERING) return;
+
   unsigned long microsNow = micros();
-  if (microsNow - _microsPrevious >= _microsPerReading) {
-    // Read data
-    sensors_event_t accel;
-    sensors_event_t gyro;
-    sensors_event_t temp;
+  bool shouldDrain = false;
 
-    _lsm6.getEvent(&accel, &gyro, &temp);
+  if (_imuUseAsync) {
+    i2cAsyncPoll();
 
-    _gyroRatesDPS[0] = _radToDeg(gyro.gyro.x) - _gyroOffsetsDPS[0];
-    _gyroRatesDPS[1] = _radToDeg(gyro.gyro.y) - _gyroOffsetsDPS[1];
-    _gyroRatesDPS[2] = _radToDeg(gyro.gyro.z) - _gyroOffsetsDPS[2];
+    if (_fifoReadState == FifoReadState::DONE) {
+      _imuFifoAsyncProcess();
+    }
+  }
 
-    _accelG[0] = _accelToG(accel.acceleration.x) - _accelOffsetsG[0];
-    _accelG[1] = _accelToG(accel.acceleration.y) - _accelOffsetsG[1];
-    _accelG[2] = _accelToG(accel.acceleration.z) - _accelOffsetsG[2];
+  shouldDrain = microsNow - _microsPrevious >= _microsPerReading;
+
+  // The last async read couldn't fit everything, so go again straight away
+  if (_fifoAsyncMore && _fifoReadState == FifoReadState::IDLE) {
+    _fifoAsyncMore = false;
+    shouldDrain = true;
+  }
 
-    // Update the filter, which will compute orientation
-    _ahrsFilter.updateIMU(_gyroRatesDPS[0], _gyroRatesDPS[1], _gyroRatesDPS[2], _accelG[0], _accelG[1], _accelG[2]);
+  if (shouldDrain && _fifoReadState == FifoReadState::IDLE) {
+    if (_imuUseAsync) {
+      // Processed from a later call, once the read completes
+      _imuFifoStartAsyncRead();
+    }
+    else {
+      _imuNoteDrain(_imuFifoDrain());
+    }
 
     // Increment the previous time so that we keep proper pace
     _microsPrevious = _microsPrevious + _microsPerReading;
 
-    // Stats
-    _imuLoopTime += micros() - microsNow;
-    _imuLoopCount++;
-
-    if (_imuLoopCount > 100) {
-      Serial.printf("[IMU] Avg AHRS Update Time: %u us\n", _imuLoopTime / _imuLoopCount);
-      _imuLoopCount = 0;
-      _imuLoopTime = 0;
+    if (_imuUseAsync) {
+      _fifoAsyncStartCostUs = micros() - microsNow;
+    }
+    else {
+      _imuDrainTimeUs += micros() - microsNow;
+      _imuDrainCount++;
     }
   }
+
+  _imuUpdateStats(microsNow);
 }
 
 /**
@@ -358,7 +1390,7 @@ float imuGetGyroRateZ() {
  * @return Current roll angle (in degrees)
  */
 float imuGetRoll() {
-  return _ahrsFilter.getRoll() - _ahrsOffsets[0];
+  return _ahrsFilter->getRoll() - _ahrsOffsets[0];
 }
 
 /**
@@ -367,7 +1399,7 @@ float imuGetRoll() {
  * @return Current pitch angle (in degrees)
  */
 float imuGetPitch() {
-  return _ahrsFilter.getPitch() - _ahrsOffsets[1];
+  return _ahrsFilter->getPitch() - _ahrsOffsets[1];
 }
 
 /**
@@ -376,7 +1408,17 @@ float imuGetPitch() {
  * @return Current yaw angle (in degrees)
  */
 float imuGetYaw() {
-  return _ahrsFilter.getYaw() - _ahrsOffsets[2];
+  return _ahrsFilter->getYaw() - _ahrsOffsets[2];
+}
+
+/**
+ * Get the current orientation quaternion, straight from the filter. Unlike the
+ * Euler angles, this is singularity free and needs no trig on the XRP
+ *
+ * @param q Output for w, x, y, z
+ */
+void imuGetQuaternion(float q[4]) {
+  _ahrsFilter->getQuaternion(q);
 }
 
 /**
@@ -385,7 +1427,7 @@ float imuGetYaw() {
  * The AHRS filter always runs, so this basically sets an offset value
  */
 void imuResetRoll() {
-  _ahrsOffsets[0] = _ahrsFilter.getRoll();
+  _ahrsOffsets[0] = _ahrsFilter->getRoll();
 }
 
 /**
@@ -394,7 +1436,7 @@ void imuResetRoll() {
  * The AHRS filter always runs, so this basically sets an offset value
  */
 void imuResetPitch() {
-  _ahrsOffsets[1] = _ahrsFilter.getPitch();
+  _ahrsOffsets[1] = _ahrsFilter->getPitch();
 }
 
 /**
@@ -403,7 +1445,44 @@ void imuResetPitch() {
  * The AHRS filter always runs, so this basically sets an offset value
  */
 void imuResetYaw() {
-  _ahrsOffsets[2] = _ahrsFilter.getYaw();
+  _ahrsOffsets[2] = _ahrsFilter->getYaw();
+}
+
+ImuHealthInfo imuGetHealth() {
+  return {_imuHealth, _imuErrorCount, _imuRecoveryCount};
+}
+
+/**
+ * Let the IMU know that the robot is moving based on other sensors (i.e. the
+ * encoders), so that the gyro bias is not updated while driving
+ */
+void imuSetMotionHint(bool moving) {
+  _imuMotionHint = moving;
+}
+
+/**
+ * Get the current gyro bias estimate
+ *
+ * @param bias Output for the X, Y, Z bias (in DPS)
+ * @return Number of times the bias has been updated since calibration
+ */
+unsigned int imuGetGyroBias(float bias[3]) {
+  memcpy(bias, _gyroOffsetsDPS, sizeof(_gyroOffsetsDPS));
+  return _biasUpdateCount;
+}
+
+/**
+ * Get AHRS timing stats, computed over the last second
+ */
+ImuStats imuGetStats() {
+  return _imuStats;
+}
+
+int imuGetFilterCosts(ImuFilterCost costs[IMU_FILTER_COUNT]) {
+  for (int i = 0; i < IMU_FILTER_COUNT; i++) {
+    costs[i] = {_filters[i]->name(), _filterCostCycles[i]};
+  }
+  return IMU_FILTER_COUNT;
 }
 
 void gyroReset() {
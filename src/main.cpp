@@ -11,6 +11,8 @@
 
 #include "byteutils.h"
 #include "config.h"
+#include "events.h"
+#include "framebuilder.h"
 #include "imu.h"
 #include "robot.h"
 #include "wpilibudp.h" 
@@ -57,6 +59,44 @@ unsigned long _loopTimeMeasurementCount = 0;
 
 uint16_t seq = 0;
 
+void sendDatagram(const char* data, int len);
+wpilibudp::FrameBuilder _frame{sendDatagram, seq};
+
+bool _lastDsActive = false;
+
+
+// Orientation telemetry, from imu.orientation in the config
+bool _sendEulerTelemetry = true;
+bool _sendQuaternionTelemetry = false;
+
+// Boot phase timestamps (ms since reset), recorded on core0 and written to status.txt
+#define MAX_BOOT_PHASES 12
+
+struct BootPhase {
+  const char *name;
+  unsigned long timeMs;
+};
+
+BootPhase _bootPhases[MAX_BOOT_PHASES];
+int _bootPhaseCount = 0;
+
+// IMU calibration runs on core1 while core0 brings up the network
+volatile bool _imuCalibrationRequested = false;
+volatile bool _imuCalibrationDone = false;
+volatile bool _imuCalibrationFromDisk = false;
+volatile unsigned long _imuCalibrationStartMs = 0;
+volatile unsigned long _imuCalibrationEndMs = 0;
+
+void markBootPhase(const char *name, unsigned long timeMs) {
+  if (_bootPhaseCount >= MAX_BOOT_PHASES) return;
+  _bootPhases[_bootPhaseCount++] = {name, timeMs};
+  Serial.printf("[BOOT] %s @ %lu ms\n", name, timeMs);
+}
+
+void markBootPhase(const char *name) {
+  markBootPhase(name, millis());
+}
+
 // Generate the status text file
 void writeStatusToDisk(NetworkMode netMode, char *chipID) {
   File f = LittleFS.open("/status.txt", "w");
@@ -75,6 +115,11 @@ void writeStatusToDisk(NetworkMode netMode, char *chipID) {
   }
 
   f.printf("IP Address: %s\n", WiFi.localIP().toString().c_str());
+
+  f.printf("IMU Calibration: %s\n", _imuCalibrationFromDisk ? "saved" : "full");
+  for (int i = 0; i < _bootPhaseCount; i++) {
+    f.printf("Boot %s: %lu ms\n", _bootPhases[i].name, _bootPhases[i].timeMs);
+  }
   f.close();
 }
 
@@ -106,79 +151,150 @@ void updateRemoteInfo() {
   }
 }
 
+// Datagrams are dropped until a host has connected
+void sendDatagram(const char* data, int len) {
+  if (udpRemoteAddr.isSet()) {
+    udp.beginPacket(udpRemoteAddr.toString().c_str(), udpRemotePort);
+    udp.write(data, len);
+    udp.endPacket();
+  }
+}
+
+// Whether a device goes in this frame. Follows the host's subscription if it
+// has sent one, otherwise the fixed legacy set
+bool telemetryDue(wpilibudp::TelemetryDevice device, bool legacyDefault, unsigned long nowMs) {
+  if (!wpilibudp::telemetrySubscribed()) {
+    return legacyDefault;
+  }
+  return wpilibudp::telemetryDue(device, nowMs);
+}
+
 void sendData() {
-  int size = 0;
-  char buffer[512];
-  int ptr = 0;
+  unsigned long nowMs = millis();
+
+  // Device clock, so that the host can issue history queries
+  _frame.addDeviceTime(micros());
 
-  uint16ToNetwork(seq, buffer);
-  buffer[2] = 0; // Unset the control byte
-  ptr = 3;
+  // Static device description, once per hello
+  if (wpilibudp::descriptorRequested()) {
+    size_t versionLen;
+    const char* version = reinterpret_cast<const char*>(GetResource_VERSION(&versionLen));
+    while (versionLen > 0 && isspace(version[versionLen - 1])) {
+      versionLen--;
+    }
+    _frame.addDescriptor(version, versionLen);
+  }
 
   // Encoders
   for (int i = 0; i < 4; i++) {
-    int encoderValue = xrp::readEncoderRaw(i);
-    uint encoderPeriod = xrp::readEncoderPeriod(i);
-
-    // We want to flip the encoder 0 value (left motor encoder) so that this returns
-    // positive values when moving forward.
-    if (i == 0) {
-      encoderValue = -encoderValue;
-      encoderPeriod ^= 1; //Last bit is direction bit; Flip it.
-    }
+    wpilibudp::TelemetryDevice device = (wpilibudp::TelemetryDevice)((int)wpilibudp::TelemetryDevice::ENCODER_0 + i);
+    if (!telemetryDue(device, true, nowMs)) continue;
+
+    int encoderValue;
+    uint encoderPeriod;
+    xrp::readEncoderOriented(i, encoderValue, encoderPeriod);
 
     static constexpr uint divisor = xrp::Encoder::getDivisor();
 
-    ptr += wpilibudp::writeEncoderData(i, encoderValue, encoderPeriod, divisor, buffer, ptr);
-  } // 4x 15 bytes
+    _frame.addEncoder(i, encoderValue, encoderPeriod, divisor);
+  }
 
   // DIO (currently just the button)
-  ptr += wpilibudp::writeDIOData(0, xrp::isUserButtonPressed(), buffer, ptr);
-  // 1x 4 bytes
+  if (telemetryDue(wpilibudp::TelemetryDevice::DIO, true, nowMs)) {
+    _frame.addDIO(0, xrp::isUserButtonPressed());
+  }
 
   // Gyro and accel data
-  float gyroRates[3] = {
-    xrp::imuGetGyroRateX(),
-    xrp::imuGetGyroRateY(),
-    xrp::imuGetGyroRateZ()
-  };
-
-  float gyroAngles[3] = {
-    xrp::imuGetRoll(),
-    xrp::imuGetPitch(),
-    xrp::imuGetYaw()
-  };
-
-  float accels[3] = {
-    xrp::imuGetAccelX(),
-    xrp::imuGetAccelY(),
-    xrp::imuGetAccelZ()
-  };
-
-  ptr += wpilibudp::writeGyroData(gyroRates, gyroAngles, buffer, ptr);
-  // 1x 26 bytes
-  ptr += wpilibudp::writeAccelData(accels, buffer, ptr);
-  // 1x 14 bytes
+  bool sendGyro = telemetryDue(wpilibudp::TelemetryDevice::GYRO, _sendEulerTelemetry, nowMs);
+  bool sendQuaternion = telemetryDue(wpilibudp::TelemetryDevice::QUATERNION, _sendQuaternionTelemetry, nowMs);
+
+  float gyroRates[3];
+  if (sendGyro || sendQuaternion) {
+    gyroRates[0] = xrp::imuGetGyroRateX();
+    gyroRates[1] = xrp::imuGetGyroRateY();
+    gyroRates[2] = xrp::imuGetGyroRateZ();
+  }
+
+  // The Euler angles are only computed when the legacy tag is being sent
+  if (sendGyro) {
+    float gyroAngles[3] = {
+      xrp::imuGetRoll(),
+      xrp::imuGetPitch(),
+      xrp::imuGetYaw()
+    };
+
+    _frame.addGyro(gyroRates, gyroAngles);
+  }
+
+  if (sendQuaternion) {
+    float quat[4];
+    xrp::imuGetQuaternion(quat);
+    _frame.addQuaternion(quat, gyroRates);
+  }
+
+  if (telemetryDue(wpilibudp::TelemetryDevice::ACCEL, true, nowMs)) {
+    float accels[3] = {
+      xrp::imuGetAccelX(),
+      xrp::imuGetAccelY(),
+      xrp::imuGetAccelZ()
+    };
+    _frame.addAccel(accels);
+  }
+
+  // Errors and recoveries saturate rather than wrap
+  if (telemetryDue(wpilibudp::TelemetryDevice::IMU_HEALTH, true, nowMs)) {
+    xrp::ImuHealthInfo imuHealth = xrp::imuGetHealth();
+    _frame.addImuHealth(
+        static_cast<uint8_t>(imuHealth.state),
+        min(imuHealth.errorCount, 0xFFFFu),
+        min(imuHealth.recoveryCount, 0xFFFFu));
+  }
 
   if (xrp::reflectanceInitialized()) {
-    ptr += wpilibudp::writeAnalogData(0, xrp::getReflectanceLeft5V(), buffer, ptr);
-    ptr += wpilibudp::writeAnalogData(1, xrp::getReflectanceRight5V(), buffer, ptr);
+    if (telemetryDue(wpilibudp::TelemetryDevice::ANALOG_0, true, nowMs)) {
+      xrp::AnalogReading left = xrp::getReflectanceLeft();
+      _frame.addAnalog(0, left.voltage, left.ageMs, left.valid);
+    }
+    if (telemetryDue(wpilibudp::TelemetryDevice::ANALOG_1, true, nowMs)) {
+      xrp::AnalogReading right = xrp::getReflectanceRight();
+      _frame.addAnalog(1, right.voltage, right.ageMs, right.valid);
+    }
   }
 
-  if (xrp::rangefinderInitialized()) {
-    ptr += wpilibudp::writeAnalogData(2, xrp::getRangefinderDistance5V(), buffer, ptr);
+  if (xrp::rangefinderInitialized() && telemetryDue(wpilibudp::TelemetryDevice::ANALOG_2, true, nowMs)) {
+    xrp::AnalogReading range = xrp::getRangefinder();
+    _frame.addAnalog(2, range.voltage, range.ageMs, range.valid);
   }
 
-  // ptr should now point to 1 past the last byte
-  size = ptr;
+  // Slew limiter state. Unsubscribed hosts only get motors that have it enabled
+  bool motorStateSubscribed = telemetryDue(wpilibudp::TelemetryDevice::MOTOR_STATE, false, nowMs);
+  for (int i = 0; i < NUM_OF_MOTORS; i++) {
+    if (motorStateSubscribed || (!wpilibudp::telemetrySubscribed() && xrp::getMotorSlewRate(i) > 0)) {
+      _frame.addMotorState(i, xrp::getMotorTarget(i), xrp::getMotorOutput(i));
+    }
+  }
 
-  // Send
-  if (udpRemoteAddr.isSet()) {
-    udp.beginPacket(udpRemoteAddr.toString().c_str(), udpRemotePort);
-    udp.write(buffer, size);
-    udp.endPacket();
-    seq++;
+  // Answers to history queries go in whatever space is left
+  _frame.addHistoryResponses();
+
+  _frame.flush();
+}
+
+// Small out-of-cycle packet for events that changed since the last poll
+void sendEventData(uint32_t events) {
+  for (int i = 0; i < (int)xrp::RobotEvent::COUNT; i++) {
+    if (!(events & (1 << i))) continue;
+
+    xrp::EventState state = xrp::eventsGetState((xrp::RobotEvent)i);
+    _frame.addEvent(i, state.active, state.timeUs, state.value);
+
+    // Hosts that don't know the event tag still see the button edge
+    if (i == (int)xrp::RobotEvent::BUTTON) {
+      _frame.addDIO(0, state.active);
+    }
   }
+
+  _frame.flush();
 }
 
 // ==================================================
@@ -243,7 +359,27 @@ void checkPrintStatus() {
   if (millis() - _lastMessageStatusPrint > 5000) {
 
     int usedHeap = rp2040.getUsedHeap();
-    Serial.printf("t(ms):%u h:%d msg:%u lt(us):%u\n", millis(), usedHeap, _wsMessageCount, _avgLoopTimeUs);
+    xrp::ImuStats imuStats = xrp::imuGetStats();
+    float gyroBias[3];
+    unsigned int biasUpdates = xrp::imuGetGyroBias(gyroBias);
+
+    // What every filter costs on the boot replay, next to the live figure for the active one
+    xrp::ImuFilterCost filterCosts[IMU_FILTER_COUNT];
+    int numFilters = xrp::imuGetFilterCosts(filterCosts);
+    char filterText[96] = "";
+    int filterTextLen = 0;
+    for (int i = 0; i < numFilters && filterTextLen < (int)sizeof(filterText); i++) {
+      filterTextLen += snprintf(filterText + filterTextLen, sizeof(filterText) - filterTextLen, "%s%s=%lu",
+          (i > 0) ? "," : "", filterCosts[i].name, filterCosts[i].updateCycles);
+    }
+
+    Serial.printf("t(ms):%u h:%d msg:%u lt(us):%u ahrs:%s ahrs(hz):%.1f ahrs(cyc):%u filters(cyc):%s imu(%%):%.1f bias(dps):%.3f,%.3f,%.3f/%u\n",
+        millis(), usedHeap, _wsMessageCount, _avgLoopTimeUs,
+        imuStats.filterName, imuStats.updateRateHz, imuStats.avgUpdateCycles, filterText, imuStats.cpuLoadPct,
+        gyroBias[0], gyroBias[1], gyroBias[2], biasUpdates);
+    if (_frame.getDroppedCount() > 0) {
+      Serial.printf("[NET] %u oversized messages dropped\n", _frame.getDroppedCount());
+    }
     _lastMessageStatusPrint = millis();
   }
 }
@@ -299,10 +435,15 @@ void setup() {
   // Set up the I2C pins
   MYWIRE.setSCL(I2C_SCL_1);
   MYWIRE.setSDA(I2C_SDA_1);
+  MYWIRE.setClock(XRP_I2C_CLOCK_HZ);
   MYWIRE.begin();
 
-  // Give a few seconds if attaching a Serail port listener
-  delay(2000);
+  // Give a few seconds if attaching a Serial port listener, but don't hold up
+  // the boot when nothing is plugged in
+  while (!Serial && millis() < 2000) {
+    delay(10);
+  }
+  markBootPhase("serial");
 
   // Generate the default SSID using the flash ID
   pico_unique_board_id_t id_out;
@@ -313,22 +454,49 @@ void setup() {
 
   // Read Config
   config = loadConfiguration(DEFAULT_SSID);
+  markBootPhase("config");
 
   // MUST BE BEFORE imuCalibrate (has digitalWrites) and configureNetwork
   xrp::robotInit();
 
+  for (int i = 0; i < config.motorConfig.slewRates.size() && i < NUM_OF_MOTORS; i++) {
+    xrp::setMotorSlewRate(i, config.motorConfig.slewRates[i]);
+  }
+
+  for (int i = 0; i < config.servoConfig.rateLimits.size() && i < NUM_OF_SERVOS; i++) {
+    xrp::setServoRateLimit(i, config.servoConfig.rateLimits[i]);
+  }
+
+  xrp::eventsReset();
+  markBootPhase("robot");
+
   // Initialize IMU
   Serial.println("[IMU] Initializing IMU");
+  xrp::imuSetSampleRate(config.imuConfig.sampleRateHz);
+  xrp::imuSetFilter(config.imuConfig.filter.c_str());
+
+  if (config.imuConfig.orientation == "quaternion") {
+    _sendEulerTelemetry = false;
+    _sendQuaternionTelemetry = true;
+  }
+  else if (config.imuConfig.orientation == "both") {
+    _sendQuaternionTelemetry = true;
+  }
+  else if (config.imuConfig.orientation != "euler") {
+    Serial.printf("[IMU] Unknown orientation format %s. Using euler\n", config.imuConfig.orientation.c_str());
+  }
   xrp::imuInit(IMU_I2C_ADDR, &MYWIRE);
+  markBootPhase("imu init");
 
-  Serial.println("[IMU] Beginning IMU calibration");
-  xrp::imuCalibrate(5000);
+  // Hand the calibration to core1 (see setup1()). The saved calibration is
+  // read here, since only core0 uses the filesystem
+  xrp::imuReadSavedCalibration();
+  _imuCalibrationRequested = true;
 
   // Setup Network
+  _frame.setMtu(config.networkConfig.mtu);
   NetworkMode netMode = setupNetwork(config);
-
-  // Write current status file
-  writeStatusToDisk(netMode,chipID);
+  markBootPhase("network");
 
   // NOTE: For now, we'll force init the reflectance sensor
   // TODO Enable this via configuration
@@ -338,6 +506,29 @@ void setup() {
   // TODO enable this via configuration
   xrp::rangefinderInit();
 
+  // The IMU needs to be calibrated before we start handling packets. Blink the
+  // LED while waiting. On the Pico W based boards the LED sits on the WiFi
+  // chip, so core1 can't drive it
+  bool ledBlinkState = true;
+  unsigned long lastBlinkTime = millis();
+  digitalWrite(LED_BUILTIN, HIGH);
+  while (!_imuCalibrationDone) {
+    if (millis() - lastBlinkTime > 100) {
+      ledBlinkState = !ledBlinkState;
+      digitalWrite(LED_BUILTIN, ledBlinkState ? HIGH : LOW);
+      lastBlinkTime = millis();
+    }
+    delay(1);
+  }
+  digitalWrite(LED_BUILTIN, LOW);
+  xrp::imuSaveCalibration();
+  markBootPhase("imu calibration start", _imuCalibrationStartMs);
+  markBootPhase("imu calibration end", _imuCalibrationEndMs);
+  markBootPhase("ready");
+
+  // Write current status file
+  writeStatusToDisk(netMode,chipID);
+
   _lastMessageStatusPrint = millis();
   _baselineUsedHeap = rp2040.getUsedHeap();
 
@@ -362,19 +553,33 @@ void loop() {
     wpilibudp::processPacket(udpPacketBuf, n);
   }
 
+  xrp::imuSetMotionHint(xrp::robotIsMoving());
   xrp::imuPeriodic();
-  xrp::rangefinderPollForData();
+  if (xrp::rangefinderInitialized()) {
+    xrp::rangefinderPeriodic();
+  }
+
+  // Subscribed events go out right away instead of waiting for the next frame
+  uint32_t events = xrp::eventsPoll();
+  if (events) {
+    sendEventData(events);
+  }
 
-  // Disable the robot when the UDP watchdog timesout
+  // Disable the robot when the UDP watchdog times out
   // Also reset the max sequence number so we can handle reconnects
-  if (!wpilibudp::dsWatchdogActive()) {
+  bool dsActive = wpilibudp::dsWatchdogActive();
+  if (!dsActive && _lastDsActive) {
     wpilibudp::resetState();
-    xrp::robotSetEnabled(false);
     xrp::imuSetEnabled(false);
   }
-
-  if (xrp::robotPeriodic()) {
-    // Package up and send all the data to client udp
+  _lastDsActive = dsActive;
+
+  // Once the host has subscribed, its requested rates drive the frames
+  // instead of the fixed robot update interval
+  uint8_t robotUpdates = xrp::robotPeriodic();
+  bool frameDue = wpilibudp::telemetrySubscribed() ? wpilibudp::telemetryFrameDue(millis()) : robotUpdates != 0;
+  if (frameDue) {
+    // Package up and send the data to client udp
     sendData();
   }
 
@@ -382,10 +587,20 @@ void loop() {
   checkPrintStatus();
 }
 
-void loop1() {
-  if (xrp::rangefinderInitialized()) {
-    xrp::rangefinderPeriodic();
+void setup1() {
+  // Wait for core0 to initialize the IMU, then calibrate it here so that the
+  // calibration overlaps with the WiFi bring up
+  while (!_imuCalibrationRequested) {
+    delay(1);
   }
 
-  delay(50);
+  _imuCalibrationStartMs = millis();
+  _imuCalibrationFromDisk = xrp::imuLoadCalibration();
+  if (!_imuCalibrationFromDisk) {
+    Serial.println("[IMU] Beginning IMU calibration");
+    xrp::imuCalibrate(5000);
+  }
+  _imuCalibrationEndMs = millis();
+  _imuCalibrationDone = true;
 }
+
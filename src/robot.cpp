@@ -2,22 +2,57 @@
 #include "wpilibudp.h"
 #include "encoder.h"
 #include "XRPServo.h"
+#include "XRPMotor.h"
+#include "adcsampler.h"
+#include "history.h"
 
 #include <map>
 #include <vector>
 
 #define MIN_UPDATE_TIME_MS 50
 
+// While not enabled, outputs are re-asserted off at this interval rather than every loop
+#define OUTPUT_VERIFY_PERIOD_MS 1000
+
+// Rangefinder ping timing. The sensor's echo line stays high for up to ~38ms
+// when nothing is in range, and the HC-SR04 wants 60ms between pings. A ping
+// sent sooner can hear the last one's echo off something past the target, which
+// reads as a near target.
+// The fast interval covers the round trip to 5m (29ms), so it only risks
+// strays from walls further away than that. It is used once a few readings in a
+// row agree, so a stray that does get through breaks the run and drops back to
+// 60ms straight away. The trade-off is that a target moving by more than the
+// tolerance between pings is only read every 60ms
+#define RANGEFINDER_ECHO_TIMEOUT_US 40000
+#define RANGEFINDER_PING_INTERVAL_US 60000
+#define RANGEFINDER_FAST_PING_INTERVAL_US 30000
+#define RANGEFINDER_AGREE_READINGS 3
+#define RANGEFINDER_AGREE_TOLERANCE_M 0.05f
+
+// Rangefinder filtering
+#define RANGEFINDER_MEDIAN_WINDOW 5
+#define RANGEFINDER_MAX_MISSES 3
+
+// How long after the last encoder tick the robot is still considered to be moving
+#define ROBOT_MOTION_TIMEOUT_MS 500
+
 namespace xrp {
 
 bool _robotInitialized = false;
-bool _robotEnabled = false;
+RobotState _robotState = RobotState::WATCHDOG_LOST;
 unsigned long _lastRobotPeriodicCall = 0;
+unsigned long _lastOutputVerifyTime = 0;
+unsigned long _lastSlewUpdateMicros = 0;
+unsigned long _lastEncoderMotionTime = 0;
 
 // Digital IO
 bool _lastUserButtonState = false;
 
-// Encoders
+// Encoders. Ticks are recorded into the history at most once per record
+// period, stamped with the time of the latest tick
+unsigned long _encoderLastTickUs[NUM_OF_ENCODERS];
+bool _encoderTicked[NUM_OF_ENCODERS];
+
 std::vector<std::pair<int, int> > _encoderPins = {
   {MOTOR_L_ENCODER_A, MOTOR_L_ENCODER_B},
   {MOTOR_R_ENCODER_A, MOTOR_R_ENCODER_B},
@@ -25,6 +60,13 @@ std::vector<std::pair<int, int> > _encoderPins = {
   {MOTOR_4_ENCODER_A, MOTOR_4_ENCODER_B}
 };
 
+std::vector<std::pair<int, int> > _motorPins = {
+  {MOTOR_L_IN_1, MOTOR_L_IN_2},
+  {MOTOR_R_IN_1, MOTOR_R_IN_2},
+  {MOTOR_3_IN_1, MOTOR_3_IN_2},
+  {MOTOR_4_IN_1, MOTOR_4_IN_2}
+};
+
 std::vector<int> _servoPins = {
   SERVO_1,
   SERVO_2,
@@ -37,17 +79,46 @@ std::map<int, int> _encoderWPILibChannelToNativeMap;
 //Encoder PIO
 Encoder encoders[NUM_OF_ENCODERS];
 
+// Motor array
+XRPMotor motors[NUM_OF_MOTORS];
+
 // Servo array
 XRPServo servos[NUM_OF_SERVOS];
 
 
 // Reflectance
 bool _reflectanceInitialized = false;
+void _recordReflectanceHistory();
 
 // Rangefinder
+enum class RangefinderState {
+  IDLE,
+  WAITING
+};
+
 bool _rangefinderInitialized = false;
 float _rangefinderDistMetres = 0.0f;
 const float RANGEFINDER_MAX_DIST_M = 4.0f;
+RangefinderState _rangefinderState = RangefinderState::IDLE;
+unsigned long _pingStartUs = 0;
+bool _rangefinderValid = false;
+unsigned long _rangefinderSampleTimeUs = 0;
+int _rangefinderMissCount = 0;
+int _rangefinderAgreeCount = 0; // Readings in a row within the tolerance of the last
+float _rangefinderLastMetres = 0.0f;
+
+// Recent valid readings (in metres), for the median filter
+float _rangefinderWindow[RANGEFINDER_MEDIAN_WINDOW];
+int _rangefinderWindowIdx = 0;
+int _rangefinderWindowCount = 0;
+
+// Echo capture, written by the edge interrupt. Edges are only measured while
+// armed, between the trigger and the result being taken
+volatile bool _echoArmed = false;
+volatile bool _echoStarted = false;
+volatile bool _echoComplete = false;
+volatile unsigned long _echoRiseUs = 0;
+volatile unsigned long _echoWidthUs = 0;
 
 bool _initEncoders() {
   for(int i=0; i < NUM_OF_ENCODERS; ++i) {
@@ -70,28 +141,51 @@ int _updateEncoders() {
     if(next >= 8) {
       Serial.printf("[ENC-%u] Encoder Possible PIO RX Buffer Overrun: %d\n", i, next);
     }
+    if (next > 0) {
+      _encoderLastTickUs[i] = micros();
+      _encoderTicked[i] = true;
+    }
     count += next;
   }
   return count;
 }
 
+/**
+ * Record the encoders that have ticked since they were last recorded. A tick
+ * that lands inside the record period is picked up on a later call, so the
+ * history always ends on the final count
+ */
+void _recordEncoderHistory() {
+  for (int i = 0; i < NUM_OF_ENCODERS; i++) {
+    HistorySensor sensor = (HistorySensor)((int)HistorySensor::ENCODER_0 + i);
+    if (!_encoderTicked[i] || !historyRecordDue(sensor, micros())) continue;
+
+    int count;
+    uint period;
+    readEncoderOriented(i, count, period);
+
+    HistoryValue values[2];
+    values[0].f = (float)count;
+    values[1].u = period;
+    historyRecord(sensor, _encoderLastTickUs[i], values);
+    _encoderTicked[i] = false;
+  }
+}
+
 
-void _initMotors() {
-  // Left
-  pinMode(MOTOR_L_IN_1, OUTPUT);
-  pinMode(MOTOR_L_IN_2, OUTPUT);
+bool _initMotors() {
+  bool success = true;
 
-  // RIGHT
-  pinMode(MOTOR_R_IN_1, OUTPUT);
-  pinMode(MOTOR_R_IN_2, OUTPUT);
+  XRPMotor::configure(XRP_MOTOR_PWM_FREQ_HZ, XRP_MOTOR_PWM_RESOLUTION_BITS);
 
-  // Motor 3
-  pinMode(MOTOR_3_IN_1, OUTPUT);
-  pinMode(MOTOR_3_IN_2, OUTPUT);
+  for (int i = 0; i < NUM_OF_MOTORS; i++) {
+    if (!motors[i].init(_motorPins[i].first, _motorPins[i].second)) {
+      success = false;
+    }
+  }
 
-  // Motor 4
-  pinMode(MOTOR_4_IN_1, OUTPUT);
-  pinMode(MOTOR_4_IN_2, OUTPUT);
+  XRPMotor::startAll();
+  return success;
 }
 
 bool _initServos() {
@@ -104,67 +198,71 @@ bool _initServos() {
   return success;
 }
 
-#ifdef PICO_RP2350
-
-void _setMotorPwmValueInternal(int in2, int in1, double value) {
-  boolean is_forward = (value >= 0.0);
-  int speed = (abs(value) * 255);
-  
-  // Direction determines which pin should be the brake
-  if(is_forward) {
-    digitalWrite(in2,LOW);
-    analogWrite(in1, speed);
-  } else {
-    digitalWrite(in1,LOW);
-    analogWrite(in2, speed);    
-  }
+void _commitMotorValues() {
+  XRPMotor::applyAll(motors, NUM_OF_MOTORS);
 }
 
-#else
+void _updateOutputRamps() {
+  unsigned long now = micros();
+  float dtSec = (now - _lastSlewUpdateMicros) / 1000000.0f;
+  _lastSlewUpdateMicros = now;
 
-void _setMotorPwmValueInternal(int en, int ph, double value) {
-  
-  PinStatus phValue = (value < 0.0) ? LOW : HIGH;
-  int enValue = (abs(value) * 255);
+  if (_robotState != RobotState::ENABLED) return;
 
-  digitalWrite(ph, phValue);
-  analogWrite(en, enValue);
-}
+  bool changed = false;
+  for (int i = 0; i < NUM_OF_MOTORS; i++) {
+    if (motors[i].updateSlew(dtSec)) {
+      changed = true;
+    }
+  }
 
-#endif
+  if (changed) {
+    _commitMotorValues();
+  }
 
-void _setPwmValueInternal(int channel, double value, bool override) {
-  if (!_robotEnabled && !override) return;
+  for (int i = 0; i < NUM_OF_SERVOS; i++) {
+    servos[i].update(dtSec);
+  }
+}
 
-  if (!wpilibudp::dsWatchdogActive() && !override) {
-    return;
+void _setMotorValueInternal(int motorIdx, double value, bool override) {
+  // Overrides are used for shutoff, so they skip the slew limiter
+  if (override) {
+    motors[motorIdx].setValue(value);
   }
+  else {
+    motors[motorIdx].setTarget(value);
+  }
+}
+
+void _setPwmValueInternal(int channel, double value, bool override) {
+  if (_robotState != RobotState::ENABLED && !override) return;
 
   // Hard coded channel list
   switch (channel) {
     case WPILIB_CH_PWM_MOTOR_L:
-      _setMotorPwmValueInternal(MOTOR_L_IN_2, MOTOR_L_IN_1, value);
+      _setMotorValueInternal(0, value, override);
       break;
     case WPILIB_CH_PWM_MOTOR_R:
-      _setMotorPwmValueInternal(MOTOR_R_IN_2, MOTOR_R_IN_1, value);
+      _setMotorValueInternal(1, value, override);
       break;
     case WPILIB_CH_PWM_MOTOR_3:
-      _setMotorPwmValueInternal(MOTOR_3_IN_2, MOTOR_3_IN_1, value);
+      _setMotorValueInternal(2, value, override);
       break;
     case WPILIB_CH_PWM_MOTOR_4:
-      _setMotorPwmValueInternal(MOTOR_4_IN_2, MOTOR_4_IN_1, value);
+      _setMotorValueInternal(3, value, override);
       break;
     case WPILIB_CH_PWM_SERVO_1:
-      servos[0].setValue(value);
+      servos[0].setValue(value, override);
       break;
     case WPILIB_CH_PWM_SERVO_2:
-      servos[1].setValue(value);
+      servos[1].setValue(value, override);
       break;
     case WPILIB_CH_PWM_SERVO_3:
-      servos[2].setValue(value);
+      servos[2].setValue(value, override);
       break;
     case WPILIB_CH_PWM_SERVO_4:
-      servos[3].setValue(value);
+      servos[3].setValue(value, override);
       break;
   }
 }
@@ -178,6 +276,43 @@ void _pwmShutoff() {
   _setPwmValueInternal(WPILIB_CH_PWM_SERVO_2, 0, true);
   _setPwmValueInternal(WPILIB_CH_PWM_SERVO_3, 0, true);
   _setPwmValueInternal(WPILIB_CH_PWM_SERVO_4, 0, true);
+  _commitMotorValues();
+}
+
+const char* _robotStateName(RobotState state) {
+  switch (state) {
+    case RobotState::ENABLED:
+      return "Enabled";
+    case RobotState::DISABLED:
+      return "Disabled";
+    case RobotState::WATCHDOG_LOST:
+      return "Watchdog Lost";
+  }
+  return "Unknown";
+}
+
+void _setRobotState(RobotState nextState) {
+  if (nextState == _robotState) return;
+
+  Serial.printf("[XRP] %s -> %s\n", _robotStateName(_robotState), _robotStateName(nextState));
+
+  // Outputs are zeroed on every transition. When enabling, this prevents
+  // motors from starting with arbitrary values
+  _pwmShutoff();
+  _lastOutputVerifyTime = millis();
+
+  if (nextState == RobotState::ENABLED) {
+    for(auto& encoder : encoders) {
+      encoder.enable();
+    }
+  }
+  else if (_robotState == RobotState::ENABLED) {
+    for(auto& encoder : encoders) {
+      encoder.disable();
+    }
+  }
+
+  _robotState = nextState;
 }
 
 void robotInit() {
@@ -193,7 +328,9 @@ void robotInit() {
 
   // Set up the motors
   Serial.println("[XRP] Initializing Motors");
-  _initMotors();
+  if (!_initMotors()) {
+    Serial.println("  - ERROR");
+  }
 
   // Set up servos
   Serial.println("[XRP] Initializing Servos");
@@ -212,13 +349,23 @@ bool robotInitialized() {
 uint8_t robotPeriodic() {
   uint8_t ret = 0;
 
-  // Kill PWM if the watchdog is dead
-  // We want this to run as quickly as possible
-  if (!wpilibudp::dsWatchdogActive()) {
+  // Kill PWM if the watchdog is dead. This only acts on the transition; after
+  // that, the outputs are verified off at a slower cadence
+  if (_robotState != RobotState::WATCHDOG_LOST && !wpilibudp::dsWatchdogActive()) {
+    _setRobotState(RobotState::WATCHDOG_LOST);
+  }
+
+  if (_robotState != RobotState::ENABLED && millis() - _lastOutputVerifyTime >= OUTPUT_VERIFY_PERIOD_MS) {
     _pwmShutoff();
+    _lastOutputVerifyTime = millis();
   }
 
-  _updateEncoders();
+  if (_updateEncoders() > 0) {
+    _lastEncoderMotionTime = millis();
+  }
+  _recordEncoderHistory();
+  _recordReflectanceHistory();
+  _updateOutputRamps();
 
   // Only check if user button pressed at the less frequent interval
   if (millis() - _lastRobotPeriodicCall < MIN_UPDATE_TIME_MS) return ret;
@@ -237,33 +384,22 @@ uint8_t robotPeriodic() {
   return ret;
 }
 
+// True if any encoder has ticked recently
+bool robotIsMoving() {
+  return millis() - _lastEncoderMotionTime < ROBOT_MOTION_TIMEOUT_MS;
+}
+
 bool isUserButtonPressed() {
   // This is a pull up circuit, so when pressed, the pin is low
   return digitalRead(BOARD_USER_BUTTON) == LOW;
 }
 
 void robotSetEnabled(bool enabled) {
-  // Prevent motors from starting with arbitrary values when enabling
-  if (!_robotEnabled && enabled) {
-    _pwmShutoff();
-    for(auto& encoder : encoders) {
-      encoder.enable();
-    }
-  }
-
-  bool prevEnabledValue = _robotEnabled;
-  _robotEnabled = enabled;
+  _setRobotState(enabled ? RobotState::ENABLED : RobotState::DISABLED);
+}
 
-  if (prevEnabledValue && !enabled) {
-    Serial.println("[XRP] Disabling");
-    _pwmShutoff();
-    for(auto& encoder : encoders) {
-      encoder.disable();
-    }
-  }
-  else if (!prevEnabledValue && enabled) {
-    Serial.println("[XRP] Enabling");
-  }
+RobotState robotGetState() {
+  return _robotState;
 }
 
 void configureEncoder(int deviceId, int chA, int chB) {
@@ -292,10 +428,63 @@ uint readEncoderPeriod(int rawDeviceId) {
   return encoders[rawDeviceId].getPeriod();
 }
 
+void readEncoderOriented(int rawDeviceId, int &count, uint &period) {
+  count = readEncoderRaw(rawDeviceId);
+  period = readEncoderPeriod(rawDeviceId);
+
+  if (rawDeviceId == 0) {
+    count = -count;
+    period ^= 1; // Last bit is direction bit; Flip it.
+  }
+}
+
 void setPwmValue(int wpilibChannel, double value) {
   _setPwmValueInternal(wpilibChannel, value, false);
 }
 
+void commitPwmValues() {
+  _commitMotorValues();
+}
+
+void setMotorSlewRate(int motorIdx, float ratePerSec) {
+  if (motorIdx < 0 || motorIdx >= NUM_OF_MOTORS) return;
+  motors[motorIdx].setSlewRate(ratePerSec);
+}
+
+float getMotorSlewRate(int motorIdx) {
+  return motors[motorIdx].getSlewRate();
+}
+
+double getMotorTarget(int motorIdx) {
+  return motors[motorIdx].getTarget();
+}
+
+double getMotorOutput(int motorIdx) {
+  return motors[motorIdx].getOutput();
+}
+
+void setServoPulseWidth(int wpilibChannel, int pulseUs) {
+  if (_robotState != RobotState::ENABLED) return;
+
+  int servoIdx = wpilibChannel - WPILIB_CH_PWM_SERVO_1;
+  if (servoIdx < 0 || servoIdx >= NUM_OF_SERVOS) return;
+
+  servos[servoIdx].setPulseWidth(pulseUs);
+}
+
+void setServoRateLimit(int servoIdx, float usPerSec) {
+  if (servoIdx < 0 || servoIdx >= NUM_OF_SERVOS) return;
+  servos[servoIdx].setRateLimit(usPerSec);
+}
+
+int getServoCount() {
+  int count = 0;
+  for (int i = 0; i < NUM_OF_SERVOS; i++) {
+    if (_servoPins[i] != __XRP_PIN_UNDEF) count++;
+  }
+  return count;
+}
+
 void setDigitalOutput(int channel, bool value) {
   if (channel == 1) {
     // LED
@@ -306,6 +495,13 @@ void setDigitalOutput(int channel, bool value) {
 void reflectanceInit() {
   analogReadResolution(12);
 
+  // Sample in the background. Falls back to analogRead if the DMA channels
+  // aren't available
+  const uint8_t pins[] = {LINE_L, LINE_R};
+  if (!adcSamplerInit(pins, 2)) {
+    Serial.println("[LINE] Background sampling unavailable, using analogRead");
+  }
+
   _reflectanceInitialized = true;
 }
 
@@ -316,25 +512,85 @@ bool reflectanceInitialized() {
 /**
  * Return a scaled voltage (0 to 1) based off analog pin reading
  */
-float _readAnalogPinScaled(uint8_t pin) {
+float _readAnalogPinScaled(uint8_t pin, unsigned long *sampleTimeUs = nullptr) {
+  if (adcSamplerIsRunning()) {
+    AdcReading reading = adcSamplerRead(pin);
+    if (reading.samples > 0) {
+      if (sampleTimeUs) *sampleTimeUs = reading.timestampUs;
+      return reading.value;
+    }
+  }
+
+  if (sampleTimeUs) *sampleTimeUs = micros();
   float scaled = (float)analogRead(pin) / 4095.0f;
   return scaled;
 }
 
-float getReflectanceLeft5V() {
+uint16_t _ageMs(unsigned long sampleTimeUs) {
+  unsigned long ageMs = (micros() - sampleTimeUs) / 1000;
+  return ageMs > 0xFFFF ? 0xFFFF : ageMs;
+}
+
+/**
+ * Record the line sensors into the history once per record period, at the
+ * time of the newest ADC sample in each reading
+ */
+void _recordReflectanceHistory() {
+  if (!_reflectanceInitialized || !historyRecordDue(HistorySensor::ANALOG_0, micros())) return;
+
+  unsigned long sampleTimeUs;
+  float left = _readAnalogPinScaled(LINE_L, &sampleTimeUs) * 5.0f;
+  historyRecord(HistorySensor::ANALOG_0, sampleTimeUs, &left);
+
+  float right = _readAnalogPinScaled(LINE_R, &sampleTimeUs) * 5.0f;
+  historyRecord(HistorySensor::ANALOG_1, sampleTimeUs, &right);
+}
+
+AnalogReading _readReflectance(uint8_t pin) {
   if (!_reflectanceInitialized) {
-    return -1.0f;
+    return {-1.0f, 0xFFFF, false};
   }
 
-  return _readAnalogPinScaled(LINE_L) * 5.0f;
+  unsigned long sampleTimeUs;
+  float voltage = _readAnalogPinScaled(pin, &sampleTimeUs) * 5.0f;
+  return {voltage, _ageMs(sampleTimeUs), true};
+}
+
+float getReflectanceLeft5V() {
+  return _readReflectance(LINE_L).voltage;
 }
 
 float getReflectanceRight5V() {
-  if (!_reflectanceInitialized) {
-    return -1.0f;
-  }
+  return _readReflectance(LINE_R).voltage;
+}
 
-  return _readAnalogPinScaled(LINE_R) * 5.0f;
+AnalogReading getReflectanceLeft() {
+  return _readReflectance(LINE_L);
+}
+
+AnalogReading getReflectanceRight() {
+  return _readReflectance(LINE_R);
+}
+
+/**
+ * Echo pin edge handler. Timestamps the rising edge and measures the pulse
+ * width on the falling edge
+ */
+void _rangefinderEchoIsr() {
+  // Late echoes and noise between pings
+  if (!_echoArmed || _echoComplete) return;
+
+  unsigned long nowUs = micros();
+
+  if (digitalRead(DISTANCE_ECHO) == HIGH) {
+    _echoRiseUs = nowUs;
+    _echoStarted = true;
+  }
+  else if (_echoStarted) {
+    _echoWidthUs = nowUs - _echoRiseUs;
+    _echoStarted = false;
+    _echoComplete = true;
+  }
 }
 
 void rangefinderInit() {
@@ -342,6 +598,9 @@ void rangefinderInit() {
   digitalWrite(DISTANCE_TRIGGER, LOW);
 
   pinMode(DISTANCE_ECHO, INPUT); // Echo pin
+  attachInterrupt(digitalPinToInterrupt(DISTANCE_ECHO), _rangefinderEchoIsr, CHANGE);
+
+  _rangefinderState = RangefinderState::IDLE;
   _rangefinderInitialized = true;
 }
 
@@ -353,54 +612,142 @@ float getRangefinderDistance5V() {
   return (_rangefinderDistMetres / RANGEFINDER_MAX_DIST_M) * 5.0f;
 }
 
-void rangefinderPollForData() {
-  uint32_t bits = 0;
-  if (rp2040.fifo.pop_nb(&bits)) {
-    memcpy(&_rangefinderDistMetres, &bits, sizeof(_rangefinderDistMetres));
+AnalogReading getRangefinder() {
+  if (!_rangefinderInitialized) {
+    return {-1.0f, 0xFFFF, false};
   }
-}
 
-void rangefinderPeriodic() {
-  unsigned long t1;
-  unsigned long t2;
-  unsigned long pulseWidth;
-  float distCM;
-  float distMetres = RANGEFINDER_MAX_DIST_M;
-
-  // Stabilize the sensor
-  digitalWrite(DISTANCE_TRIGGER, LOW);
-  delayMicroseconds(5);
-  digitalWrite(DISTANCE_TRIGGER, HIGH);
+  return {getRangefinderDistance5V(), _ageMs(_rangefinderSampleTimeUs), _rangefinderValid};
+}
 
-  // Send a 10us pulse
-  delayMicroseconds(10);
-  digitalWrite(DISTANCE_TRIGGER, LOW);
+/**
+ * Median of the recent valid echoes, which rejects the odd spurious echo
+ * without the lag of an average
+ */
+float _rangefinderMedian() {
+  float sorted[RANGEFINDER_MEDIAN_WINDOW];
+  for (int i = 0; i < _rangefinderWindowCount; i++) {
+    float value = _rangefinderWindow[i];
+    int j = i;
+    while (j > 0 && sorted[j - 1] > value) {
+      sorted[j] = sorted[j - 1];
+      j--;
+    }
+    sorted[j] = value;
+  }
+  return sorted[_rangefinderWindowCount / 2];
+}
 
-  // wait for pulse on the echo pin
-  while (digitalRead(DISTANCE_ECHO) == 0);
+// Each published reading goes into the history once, at the echo time
+void _rangefinderRecordHistory() {
+  float range = getRangefinderDistance5V();
+  historyRecord(HistorySensor::ANALOG_2, _rangefinderSampleTimeUs, &range);
+}
 
-  t1 = micros();
-  while (digitalRead(DISTANCE_ECHO) == 1) {
-    if (micros() - t1 > ULTRASONIC_MAX_PULSE_WIDTH) {
-      break;
+/**
+ * Handle the result of a ping. Failed pings (no echo, or out of range) don't
+ * go into the filter. After a few in a row, the reading is reported as
+ * invalid at max range
+ */
+void _rangefinderPublish(unsigned long pulseWidthUs, unsigned long sampleTimeUs) {
+  if (pulseWidthUs > ULTRASONIC_MAX_PULSE_WIDTH) {
+    _rangefinderAgreeCount = 0;
+    if (++_rangefinderMissCount >= RANGEFINDER_MAX_MISSES) {
+      _rangefinderDistMetres = RANGEFINDER_MAX_DIST_M;
+      _rangefinderValid = false;
+
+      // Restart the window from slot 0, so the median only sees new readings
+      _rangefinderWindowCount = 0;
+      _rangefinderWindowIdx = 0;
+      _rangefinderSampleTimeUs = sampleTimeUs;
+      _rangefinderRecordHistory();
     }
+    return;
   }
-  t2 = micros();
-  pulseWidth = t2 - t1;
 
-  distCM = pulseWidth / 58.0;
+  _rangefinderMissCount = 0;
 
-  if (pulseWidth > ULTRASONIC_MAX_PULSE_WIDTH) {
-    distMetres = RANGEFINDER_MAX_DIST_M;
+  float distMetres = (pulseWidthUs / 58.0f) / 100.0f;
+  if (_rangefinderAgreeCount > 0 && fabsf(distMetres - _rangefinderLastMetres) > RANGEFINDER_AGREE_TOLERANCE_M) {
+    _rangefinderAgreeCount = 0;
   }
-  else {
-    distMetres = distCM / 100.0f;
+  _rangefinderAgreeCount++;
+  _rangefinderLastMetres = distMetres;
+
+  _rangefinderWindow[_rangefinderWindowIdx] = distMetres;
+  _rangefinderWindowIdx = (_rangefinderWindowIdx + 1) % RANGEFINDER_MEDIAN_WINDOW;
+  if (_rangefinderWindowCount < RANGEFINDER_MEDIAN_WINDOW) {
+    _rangefinderWindowCount++;
   }
 
-  // convert to a uint32_t so that we can push it onto the FIFO
-  uint32_t bits = 0;
-  memcpy(&bits, &distMetres, sizeof(bits));
-  bool result = rp2040.fifo.push_nb(bits);
+  _rangefinderDistMetres = _rangefinderMedian();
+  _rangefinderValid = true;
+  _rangefinderSampleTimeUs = sampleTimeUs;
+  _rangefinderRecordHistory();
+}
+
+/**
+ * Ping faster once the readings have settled. See RANGEFINDER_PING_INTERVAL_US
+ */
+unsigned long _rangefinderPingIntervalUs() {
+  if (_rangefinderAgreeCount >= RANGEFINDER_AGREE_READINGS) {
+    return RANGEFINDER_FAST_PING_INTERVAL_US;
+  }
+  return RANGEFINDER_PING_INTERVAL_US;
+}
+
+/**
+ * Non-blocking ping state machine. The echo is measured by the edge interrupt,
+ * so this only sends the trigger and checks for a result or a timeout
+ */
+void rangefinderPeriodic() {
+  unsigned long nowUs = micros();
+
+  switch (_rangefinderState) {
+    case RangefinderState::IDLE:
+      if (nowUs - _pingStartUs < _rangefinderPingIntervalUs()) {
+        return;
+      }
+
+      noInterrupts();
+      _echoStarted = false;
+      _echoComplete = false;
+      _echoArmed = true;
+      interrupts();
+
+      // 10us trigger pulse
+      digitalWrite(DISTANCE_TRIGGER, HIGH);
+      delayMicroseconds(10);
+      digitalWrite(DISTANCE_TRIGGER, LOW);
+
+      _pingStartUs = micros();
+      _rangefinderState = RangefinderState::WAITING;
+      break;
+
+    case RangefinderState::WAITING: {
+      // Take a consistent copy of the capture, and stop listening if it's done
+      noInterrupts();
+      bool complete = _echoComplete;
+      unsigned long riseUs = _echoRiseUs;
+      unsigned long widthUs = _echoWidthUs;
+      bool timedOut = !complete && nowUs - _pingStartUs > RANGEFINDER_ECHO_TIMEOUT_US;
+      if (complete || timedOut) {
+        _echoArmed = false;
+      }
+      interrupts();
+
+      if (complete) {
+        _rangefinderPublish(widthUs, riseUs + widthUs);
+        _rangefinderState = RangefinderState::IDLE;
+      }
+      else if (timedOut) {
+        // No echo at all (i.e. sensor unplugged), or it never ended
+        _rangefinderPublish(ULTRASONIC_MAX_PULSE_WIDTH + 1, nowUs);
+        _rangefinderState = RangefinderState::IDLE;
+      }
+      break;
+    }
+  }
 }
 
 } // namespace xrp
@@ -3,6 +3,9 @@
 #include "robot.h"
 #include "watchdog.h"
 #include "imu.h"
+#include "history.h"
+#include "events.h"
+#include "encoder.h"
 
 // Since we might (nay, will) rollover, the fudge factor lets us deal with cases like
 // 65532, 65533, 0, 65534, 65535 by taking 0 as the new highest seq number
@@ -14,6 +17,46 @@ namespace wpilibudp {
 uint16_t currMaxSeq = 0;
 xrp::Watchdog _dsWatchdog{"status"};
 
+// History queries waiting to be answered in the outbound data
+#define MAX_PENDING_HISTORY_QUERIES 8
+
+struct HistoryQuery {
+  uint8_t sensor;
+  uint8_t mode;
+  uint32_t startUs;
+  uint32_t endUs;
+
+  // Window paging resumes strictly after the last sample sent. A position
+  // would skip samples once the ring evicts the oldest ones
+  bool resumed;
+  uint32_t lastSentUs;
+};
+
+HistoryQuery _historyQueries[MAX_PENDING_HISTORY_QUERIES];
+int _numHistoryQueries = 0;
+
+// Session state from the hello
+uint8_t _sessionVersion = 1;
+bool _sessionCompact = false;
+bool _descriptorRequested = false;
+
+// Keeps the descriptor within XRP_MSG_SIZE_DESCRIPTOR
+#define DESCRIPTOR_MAX_STRING_LEN 32
+
+// The size table has to cover the variable length and compact layouts too
+static_assert(XRP_MSG_SIZE_DESCRIPTOR == 13 + 2 * DESCRIPTOR_MAX_STRING_LEN, "Descriptor size mismatch");
+static_assert(XRP_MSG_SIZE_HISTORY_SAMPLE == 8 + 4 * HISTORY_MAX_FIELDS, "History sample size mismatch");
+static_assert(XRP_MSG_SIZE_ENCODER >= 3 + 5 + 5, "Compact encoder doesn't fit");
+static_assert(XRP_MSG_SIZE_GYRO >= CompactGyroMessage::size, "Compact gyro doesn't fit");
+static_assert(XRP_MSG_SIZE_ACCEL >= CompactAccelMessage::size, "Compact accel doesn't fit");
+static_assert(XRP_MSG_SIZE_ANALOG >= CompactAnalogMessage::size, "Compact analog doesn't fit");
+
+// Telemetry subscription. A period of 0 means the device isn't sent
+bool _telemetrySubscribed = false;
+uint16_t _telemetryPeriodMs[(int)TelemetryDevice::COUNT];
+unsigned long _telemetryLastSentMs[(int)TelemetryDevice::COUNT];
+unsigned long _telemetryLastFrameMs = 0;
+
 bool _processTaggedData(char* buffer, int start, int end) {
   // The data here is the 1 byte tag and n byte payload
   // range is [start, end) in buffer
@@ -25,38 +68,139 @@ bool _processTaggedData(char* buffer, int start, int end) {
   switch (tag) {
     case XRP_TAG_MOTOR: {
       // Verify size
-      if (end - start < 6) {
+      if (end - start < MotorMessage::payloadSize) {
         return false;
       }
 
-      int channel = buffer[start+1];
-      float value = networkToFloat(buffer, start+2);
+      uint8_t channel;
+      float value;
+      MotorMessage::decode(buffer, start, channel, value);
 
       xrp::setPwmValue(channel, value);
     } break;
     case XRP_TAG_SERVO: {
       // Verify size
-      if (end - start < 6) {
+      if (end - start < ServoMessage::payloadSize) {
         return false;
       }
 
-      int channel = buffer[start+1];
-      float value = networkToFloat(buffer, start+2);
+      uint8_t channel;
+      float value;
+      ServoMessage::decode(buffer, start, channel, value);
 
       // Servo position info comes as a 0 to 1 range
       // we need to convert to -1 to 1
       value = (2.0 * value) - 1.0;
       xrp::setPwmValue(channel, value);
     } break;
+    case XRP_TAG_SERVO_PULSE: {
+      // Verify size
+      if (end - start < ServoPulseMessage::payloadSize) {
+        return false;
+      }
+
+      uint8_t channel;
+      uint16_t pulseUs;
+      ServoPulseMessage::decode(buffer, start, channel, pulseUs);
+
+      xrp::setServoPulseWidth(channel, pulseUs);
+    } break;
+    case XRP_TAG_HISTORY_QUERY: {
+      // sensor(1) mode(1) start(4) [end(4)]
+      if (end - start < HistoryQueryMessage::payloadSize) {
+        return false;
+      }
+
+      if (_numHistoryQueries >= MAX_PENDING_HISTORY_QUERIES) {
+        return false;
+      }
+
+      HistoryQuery &query = _historyQueries[_numHistoryQueries];
+      HistoryQueryMessage::decode(buffer, start, query.sensor, query.mode, query.startUs);
+      query.endUs = query.startUs;
+      query.resumed = false;
+
+      if (query.mode == XRP_HISTORY_MODE_WINDOW) {
+        if (end - start < HistoryWindowQueryMessage::payloadSize) {
+          return false;
+        }
+        HistoryWindowQueryMessage::decode(buffer, start, query.sensor, query.mode, query.startUs, query.endUs);
+      }
+
+      if (xrp::historyFieldCount(query.sensor) == 0) {
+        return false;
+      }
+
+      _numHistoryQueries++;
+    } break;
+    case XRP_TAG_EVENT_SUBSCRIBE: {
+      if (end - start < EventSubscribeMessage::payloadSize) {
+        return false;
+      }
+
+      uint8_t event;
+      uint8_t enabled;
+      float threshold;
+      EventSubscribeMessage::decode(buffer, start, event, enabled, threshold);
+
+      return xrp::eventsSubscribe(event, enabled == 1, threshold);
+    } break;
+    case XRP_TAG_TELEMETRY_SUBSCRIBE: {
+      // [device(1) period(2)] repeated. Replaces the whole subscription, so
+      // devices that aren't listed stop being sent
+      if ((end - start - 1) % 3 != 0) {
+        return false;
+      }
+
+      for (int i = 0; i < (int)TelemetryDevice::COUNT; i++) {
+        _telemetryPeriodMs[i] = 0;
+      }
+
+      for (int i = start + 1; i < end; i += 3) {
+        uint8_t device = buffer[i];
+        uint16_t periodMs = networkToUInt16(buffer, i+1);
+        if (device >= (uint8_t)TelemetryDevice::COUNT) {
+          success = false;
+          continue;
+        }
+
+        if (periodMs > 0 && periodMs < XRP_TELEMETRY_MIN_PERIOD_MS) {
+          periodMs = XRP_TELEMETRY_MIN_PERIOD_MS;
+        }
+        _telemetryPeriodMs[device] = periodMs;
+        _telemetryLastSentMs[device] = millis() - periodMs;
+      }
+
+      _telemetrySubscribed = true;
+    } break;
+    case XRP_TAG_HELLO: {
+      // Both sides use the lower of the two versions. Options are optional
+      if (end - start < HelloMessage::payloadSize) {
+        return false;
+      }
+
+      uint8_t hostVersion;
+      uint8_t options = 0;
+      if (end - start >= HelloOptionsMessage::payloadSize) {
+        HelloOptionsMessage::decode(buffer, start, hostVersion, options);
+      }
+      else {
+        HelloMessage::decode(buffer, start, hostVersion);
+      }
+      _sessionVersion = max((uint8_t)1, min(hostVersion, (uint8_t)XRP_PROTOCOL_VERSION));
+      _sessionCompact = _sessionVersion >= 2 && (options & XRP_HELLO_OPT_COMPACT);
+      _descriptorRequested = true;
+    } break;
     case XRP_TAG_DIO: {
-      if (end - start < 3) {
+      if (end - start < DioMessage::payloadSize) {
         return false;
       }
 
-      int channel = buffer[start+1];
-      bool value = buffer[start+2] == 1;
+      uint8_t channel;
+      uint8_t value;
+      DioMessage::decode(buffer, start, channel, value);
 
-      xrp::setDigitalOutput(channel, value);
+      xrp::setDigitalOutput(channel, value == 1);
     } break;
     default:
       success = false;
@@ -71,6 +215,58 @@ bool dsWatchdogActive() {
 
 void resetState() {
   currMaxSeq = 0;
+  _numHistoryQueries = 0;
+  _telemetrySubscribed = false;
+  _sessionVersion = 1;
+  _sessionCompact = false;
+  _descriptorRequested = false;
+  xrp::eventsReset();
+}
+
+uint8_t sessionVersion() {
+  return _sessionVersion;
+}
+
+bool sessionCompact() {
+  return _sessionCompact;
+}
+
+bool descriptorRequested() {
+  return _descriptorRequested;
+}
+
+bool telemetrySubscribed() {
+  return _telemetrySubscribed;
+}
+
+bool telemetryFrameDue(unsigned long nowMs) {
+  if (nowMs - _telemetryLastFrameMs < XRP_TELEMETRY_MIN_PERIOD_MS) {
+    return false;
+  }
+
+  bool due = _numHistoryQueries > 0 || _descriptorRequested;
+  for (int i = 0; i < (int)TelemetryDevice::COUNT && !due; i++) {
+    due = _telemetryPeriodMs[i] > 0 && nowMs - _telemetryLastSentMs[i] >= _telemetryPeriodMs[i];
+  }
+
+  if (due) {
+    _telemetryLastFrameMs = nowMs;
+  }
+  return due;
+}
+
+bool telemetryDue(TelemetryDevice device, unsigned long nowMs) {
+  int idx = (int)device;
+  if (_telemetryPeriodMs[idx] == 0) return false;
+  if (nowMs - _telemetryLastSentMs[idx] < _telemetryPeriodMs[idx]) return false;
+
+  // Keep to the requested rate on average, but don't try to catch up after a
+  // long gap
+  _telemetryLastSentMs[idx] += _telemetryPeriodMs[idx];
+  if (nowMs - _telemetryLastSentMs[idx] >= _telemetryPeriodMs[idx]) {
+    _telemetryLastSentMs[idx] = nowMs;
+  }
+  return true;
 }
 
 bool processPacket(char* buffer, int size) {
@@ -128,6 +324,9 @@ bool processPacket(char* buffer, int size) {
     startIdx = endIdx;
   }
 
+  // Motor values are staged while parsing, so latch them all at once
+  xrp::commitPwmValues();
+
   return true;
 }
 
@@ -136,72 +335,216 @@ bool processPacket(char* buffer, int size) {
 // ===================
 
 int writeEncoderData(int deviceId, int count, uint period, uint divisor, char* buffer, int offset) {
-  // Encoder message is 14 bytes
-  // tag(1) id(1) int(4) uint(4) uint(4)
-  int i = offset;
-  buffer[i++] = 2 + sizeof(int) + sizeof(uint) + sizeof(uint);
-  buffer[i++] = XRP_TAG_ENCODER;
-  buffer[i++] = deviceId & 0xFF;
-  int32ToNetwork(count, buffer, i);
-  i += sizeof(int);
-  int32ToNetwork(period, buffer, i);
-  i += sizeof(uint);
-  int32ToNetwork(divisor, buffer, i);
-  i += sizeof(uint);
-  return i-offset; // +1 for the size byte
+  if (_sessionCompact) {
+    // Compact encoder message is 4 to 12 bytes
+    // tag(1) id(1) count(zigzag varint) period+1(varint)
+    // The +1 wraps a stopped encoder (UINT_MAX) round to a single 0 byte.
+    // FrameBuilder folds consecutive encoders into one message
+    int i = offset + 1;
+    buffer[i++] = XRP_TAG_ENCODER;
+    buffer[i++] = deviceId & 0xFF;
+    i += zigzagVarintToNetwork(count, buffer, i);
+    i += varintToNetwork((uint32_t)period + 1, buffer, i);
+    buffer[offset] = i - offset - 1;
+    return i - offset; // +1 for the size byte
+  }
+
+  // The divisor moved to the descriptor in protocol version 2
+  if (_sessionVersion >= 2) {
+    return EncoderV2Message::encode(buffer, offset, deviceId & 0xFF, count, period);
+  }
+  return EncoderMessage::encode(buffer, offset, deviceId & 0xFF, count, period, divisor);
+}
+
+int writeDescriptorData(const char* firmwareVersion, int firmwareVersionLen, char* buffer, int offset) {
+  // Descriptor message is 12 + n + m bytes
+  // tag(1) version(1) capabilities(2) motors(1) servos(1) encoders(1)
+  // encoderDivisor(4) boardLen(1) board(n) firmwareVersion(m)
+  uint16_t capabilities = XRP_CAP_QUATERNION | XRP_CAP_HISTORY | XRP_CAP_EVENTS | XRP_CAP_SUBSCRIPTIONS | XRP_CAP_COMPACT;
+  if (xrp::reflectanceInitialized()) capabilities |= XRP_CAP_REFLECTANCE;
+  if (xrp::rangefinderInitialized()) capabilities |= XRP_CAP_RANGEFINDER;
+
+  const char* board = PIN_LAYOUT_IDENT;
+  int boardLen = min((int)strlen(board), DESCRIPTOR_MAX_STRING_LEN);
+  int versionLen = min(firmwareVersionLen, DESCRIPTOR_MAX_STRING_LEN);
+
+  int i = offset + 1;
+  buffer[i++] = XRP_TAG_DESCRIPTOR;
+  buffer[i++] = _sessionVersion;
+  uint16ToNetwork(capabilities, buffer, i);
+  i += 2;
+  buffer[i++] = NUM_OF_MOTORS;
+  buffer[i++] = xrp::getServoCount();
+  buffer[i++] = NUM_OF_ENCODERS;
+  uint32ToNetwork(xrp::Encoder::getDivisor(), buffer, i);
+  i += 4;
+  buffer[i++] = boardLen;
+  memcpy(buffer + i, board, boardLen);
+  i += boardLen;
+  memcpy(buffer + i, firmwareVersion, versionLen);
+  i += versionLen;
+
+  buffer[offset] = i - offset - 1;
+  _descriptorRequested = false;
+
+  return i - offset; // +1 for size byte
 }
 
 int writeDIOData(int deviceId, bool value, char* buffer, int offset) {
-  // DIO Message is 3 bytes
-  // tag(1) id(1) value(1)
-  buffer[offset] = 3;
-  buffer[offset+1] = XRP_TAG_DIO;
-  buffer[offset+2] = deviceId & 0xFF;
-  buffer[offset+3] = value ? 1 : 0;
-  return 4; // +1 for the size byte
+  return DioMessage::encode(buffer, offset, deviceId & 0xFF, value ? 1 : 0);
 }
 
 int writeGyroData(float rates[3], float angles[3], char* buffer, int offset) {
-  // Gyro message is 25 bytes
-  // tag(1) rateX(4) rateY(4) rateZ(4) angleX(4) angleY(4) angleZ(4)
-  buffer[offset] = 25;
-  buffer[offset+1] = XRP_TAG_GYRO;
-  int ratePtr = offset + 2;
-  int anglePtr = ratePtr + 12;
-  for (int i = 0; i < 3; i++) {
-    floatToNetwork(rates[i], buffer, ratePtr);
-    floatToNetwork(angles[i], buffer, anglePtr);
-
-    ratePtr += 4;
-    anglePtr += 4;
+  if (_sessionCompact) {
+    // Rates are in 1/16 deg/s, angles in 1/50 deg
+    int16_t fixedRates[3];
+    int16_t fixedAngles[3];
+    for (int i = 0; i < 3; i++) {
+      fixedRates[i] = floatToFixedPoint(rates[i], GYRO_RATE_FIXED_SCALE);
+      fixedAngles[i] = floatToFixedPoint(angles[i], ANGLE_FIXED_SCALE);
+    }
+    return CompactGyroMessage::encode(buffer, offset, fixedRates, fixedAngles);
   }
-  return 26; // +1 for the size byte
+
+  return GyroMessage::encode(buffer, offset, rates, angles);
 }
 
 int writeAccelData(float accels[3], char* buffer, int offset) {
-  // Accel message is 13 bytes
-  // tag(1) accX(4) accY(4) accZ(4)
-  buffer[offset] = 13;
-  buffer[offset+1] = XRP_TAG_ACCEL;
-  int ptr = offset + 2;
-  
+  if (_sessionCompact) {
+    // In 1/2048 g
+    int16_t fixedAccels[3];
+    for (int i = 0; i < 3; i++) {
+      fixedAccels[i] = floatToFixedPoint(accels[i], ACCEL_FIXED_SCALE);
+    }
+    return CompactAccelMessage::encode(buffer, offset, fixedAccels);
+  }
+
+  return AccelMessage::encode(buffer, offset, accels);
+}
+
+int writeAnalogData(int deviceId, float voltage, uint16_t ageMs, bool valid, char* buffer, int offset) {
+  // age and flags were added after value, so hosts that only read the value
+  // (and skip by the size byte) are unaffected
+  uint8_t flags = valid ? XRP_ANALOG_FLAG_VALID : 0;
+
+  if (_sessionCompact) {
+    // Value in 1/6000 V
+    return CompactAnalogMessage::encode(buffer, offset, deviceId, floatToFixedPoint(voltage, VOLTAGE_FIXED_SCALE), ageMs, flags);
+  }
+
+  return AnalogMessage::encode(buffer, offset, deviceId, voltage, ageMs, flags);
+}
+
+int writeMotorStateData(int deviceId, float target, float output, char* buffer, int offset) {
+  uint8_t limiting = (target != output) ? 1 : 0;
+
+  if (_sessionCompact) {
+    // In 1/32767 of full scale
+    return CompactMotorStateMessage::encode(buffer, offset, deviceId,
+        floatToFixedPoint(target, MOTOR_FIXED_SCALE), floatToFixedPoint(output, MOTOR_FIXED_SCALE), limiting);
+  }
+
+  return MotorStateMessage::encode(buffer, offset, deviceId, target, output, limiting);
+}
+
+int writeQuaternionData(float quat[4], float rates[3], char* buffer, int offset) {
+  // Components are Q2.14 fixed point, rates are in 1/16 deg/s (+-2048 deg/s)
+  int16_t fixedQuat[4];
+  int16_t fixedRates[3];
+  for (int i = 0; i < 4; i++) {
+    fixedQuat[i] = floatToFixedPoint(quat[i], QUATERNION_FIXED_SCALE);
+  }
   for (int i = 0; i < 3; i++) {
-    floatToNetwork(accels[i], buffer, ptr);
-    ptr += 4;
+    fixedRates[i] = floatToFixedPoint(rates[i], GYRO_RATE_FIXED_SCALE);
+  }
+
+  return QuaternionMessage::encode(buffer, offset, fixedQuat, fixedRates);
+}
+
+int writeDeviceTimeData(uint32_t timeUs, char* buffer, int offset) {
+  // Microseconds since boot, which is the clock the history queries use
+  return DeviceTimeMessage::encode(buffer, offset, timeUs);
+}
+
+int writeEventData(uint8_t event, bool active, uint32_t timeUs, float value, char* buffer, int offset) {
+  return EventMessage::encode(buffer, offset, event, active ? 1 : 0, timeUs, value);
+}
+
+int _writeHistorySample(uint8_t sensor, uint8_t flags, const xrp::HistorySample &sample, char* buffer, int offset) {
+  // History sample message is 7 + 4n bytes
+  // tag(1) sensor(1) flags(1) time(4) values(4 each)
+  int numFields = xrp::historyFieldCount(sensor);
+  buffer[offset] = 7 + 4 * numFields;
+  buffer[offset+1] = XRP_TAG_HISTORY_SAMPLE;
+  buffer[offset+2] = sensor;
+  buffer[offset+3] = flags;
+  toNetwork(sample.timeUs, buffer, offset+4);
+  for (int i = 0; i < numFields; i++) {
+    // Floats and raw values alike go out as their 4 bytes
+    toNetwork(sample.values[i].u, buffer, offset + 8 + 4 * i);
   }
 
-  return 14; // +1 for the size byte
+  return 8 + 4 * numFields; // +1 for size byte
 }
 
-int writeAnalogData(int deviceId, float voltage, char* buffer, int offset) {
-  // Analog message is 6 bytes
-  // tag(1) id(1) value(4)
-  buffer[offset] = 6;
-  buffer[offset+1] = XRP_TAG_ANALOG;
-  buffer[offset+2] = deviceId;
-  floatToNetwork(voltage, buffer, offset+3);
+int writeHistoryResponses(char* buffer, int offset, int maxLen) {
+  int ptr = offset;
+  int done = 0;
+
+  for (; done < _numHistoryQueries; done++) {
+    HistoryQuery &query = _historyQueries[done];
+    int sampleLen = 8 + 4 * xrp::historyFieldCount(query.sensor);
+    int room = (offset + maxLen - ptr) / sampleLen;
+    if (room == 0) break;
+
+    if (query.mode == XRP_HISTORY_MODE_WINDOW) {
+      xrp::HistorySample samples[8];
+      int maxSamples = min(room, 8);
+      int n = xrp::historyQueryWindow(query.sensor, query.resumed ? query.lastSentUs : query.startUs,
+                                      query.endUs, samples, maxSamples, query.resumed);
+      for (int i = 0; i < n; i++) {
+        ptr += _writeHistorySample(query.sensor, HISTORY_FLAG_EXACT, samples[i], buffer, ptr);
+      }
+      if (n > 0) {
+        query.resumed = true;
+        query.lastSentUs = samples[n - 1].timeUs;
+      }
+
+      // A full batch means there may be more in the window
+      if (n == maxSamples) break;
+    }
+    else {
+      xrp::HistorySample sample;
+      uint8_t flags = 0;
+      if (xrp::historyQueryAt(query.sensor, query.startUs, sample, flags)) {
+        ptr += _writeHistorySample(query.sensor, flags, sample, buffer, ptr);
+      }
+    }
+  }
+
+  // Drop the answered queries
+  for (int i = done; i < _numHistoryQueries; i++) {
+    _historyQueries[i - done] = _historyQueries[i];
+  }
+  _numHistoryQueries -= done;
+
+  return ptr - offset;
+}
+
+int writeImuHealthData(uint8_t state, uint16_t errorCount, uint16_t recoveryCount, char* buffer, int offset) {
+  if (_sessionCompact) {
+    // Compact IMU health message is 5 to 9 bytes, usually 5
+    // tag(1) state(1) errors(varint) recoveries(varint)
+    int i = offset + 1;
+    buffer[i++] = XRP_TAG_IMU_HEALTH;
+    buffer[i++] = state;
+    i += varintToNetwork(errorCount, buffer, i);
+    i += varintToNetwork(recoveryCount, buffer, i);
+    buffer[offset] = i - offset - 1;
+    return i - offset; // +1 for the size byte
+  }
 
-  return 7; // +1 for size byte
+  return ImuHealthMessage::encode(buffer, offset, state, errorCount, recoveryCount);
 }
 
-} // namespace wpilibudp
\ No newline at end of file
+} // namespace wpilibudp
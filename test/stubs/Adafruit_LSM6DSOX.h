@@ -0,0 +1,3 @@
+/* Native test stand-in. Nothing from the driver is used by the code under test */
+
+#pragma once
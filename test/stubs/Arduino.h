@@ -0,0 +1,13 @@
+/* Just enough of the Arduino core for the native tests. Anything a test
+   needs to control (the clock, the robot) is defined by that test */
+
+#pragma once
+
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+typedef unsigned int uint;
+
+unsigned long millis();
+unsigned long micros();
@@ -0,0 +1,5 @@
+/* Native test stand-in. imu.h only needs the type for imuInit() */
+
+#pragma once
+
+class TwoWire {};
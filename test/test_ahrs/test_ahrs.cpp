@@ -0,0 +1,360 @@
+/*
+ * Accuracy and speed of the in-tree AHRS filters against the Arduino Madgwick
+ * library algorithm (reproduced below as the reference).
+ *
+ * The replay trace is synthetic, so the true orientation is known: a body
+ * rotating through yaw, roll and pitch manoeuvres at 208 Hz, with gyro and
+ * accel noise. Timings are host timings. They rank the float paths but say
+ * nothing about the RP2040's soft float, where the per-update cycle count in
+ * the serial status line is the number to use.
+ */
+
+#include <unity.h>
+
+#include <chrono>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <vector>
+
+#include "ahrs.h"
+
+using namespace xrp;
+
+#define SAMPLE_RATE_HZ 208.0f
+#define TRACE_SECONDS 60
+#define BENCH_PASSES 20
+
+struct ImuSample {
+  float gx, gy, gz;
+  float ax, ay, az;
+  double q[4];
+};
+
+static std::vector<ImuSample> _trace;
+
+// ===============================
+// Reference: arduino-libraries/Madgwick updateIMU(), with an exact 1/sqrt
+// ===============================
+
+struct ReferenceMadgwick {
+  float beta = 0.1f;
+  float q0 = 1.0f, q1 = 0.0f, q2 = 0.0f, q3 = 0.0f;
+  float invSampleFreq = 1.0f / SAMPLE_RATE_HZ;
+
+  static float invSqrt(float x) { return 1.0f / sqrtf(x); }
+
+  void updateIMU(float gx, float gy, float gz, float ax, float ay, float az) {
+    float recipNorm;
+    float s0, s1, s2, s3;
+    float qDot1, qDot2, qDot3, qDot4;
+    float _2q0, _2q1, _2q2, _2q3, _4q0, _4q1, _4q2, _8q1, _8q2, q0q0, q1q1, q2q2, q3q3;
+
+    gx *= 0.0174533f;
+    gy *= 0.0174533f;
+    gz *= 0.0174533f;
+
+    qDot1 = 0.5f * (-q1 * gx - q2 * gy - q3 * gz);
+    qDot2 = 0.5f * (q0 * gx + q2 * gz - q3 * gy);
+    qDot3 = 0.5f * (q0 * gy - q1 * gz + q3 * gx);
+    qDot4 = 0.5f * (q0 * gz + q1 * gy - q2 * gx);
+
+    if (!((ax == 0.0f) && (ay == 0.0f) && (az == 0.0f))) {
+      recipNorm = invSqrt(ax * ax + ay * ay + az * az);
+      ax *= recipNorm;
+      ay *= recipNorm;
+      az *= recipNorm;
+
+      _2q0 = 2.0f * q0;
+      _2q1 = 2.0f * q1;
+      _2q2 = 2.0f * q2;
+      _2q3 = 2.0f * q3;
+      _4q0 = 4.0f * q0;
+      _4q1 = 4.0f * q1;
+      _4q2 = 4.0f * q2;
+      _8q1 = 8.0f * q1;
+      _8q2 = 8.0f * q2;
+      q0q0 = q0 * q0;
+      q1q1 = q1 * q1;
+      q2q2 = q2 * q2;
+      q3q3 = q3 * q3;
+
+      s0 = _4q0 * q2q2 + _2q2 * ax + _4q0 * q1q1 - _2q1 * ay;
+      s1 = _4q1 * q3q3 - _2q3 * ax + 4.0f * q0q0 * q1 - _2q0 * ay - _4q1 + _8q1 * q1q1 + _8q1 * q2q2 + _4q1 * az;
+      s2 = 4.0f * q0q0 * q2 + _2q0 * ax + _4q2 * q3q3 - _2q3 * ay - _4q2 + _8q2 * q1q1 + _8q2 * q2q2 + _4q2 * az;
+      s3 = 4.0f * q1q1 * q3 - _2q1 * ax + 4.0f * q2q2 * q3 - _2q2 * ay;
+      recipNorm = invSqrt(s0 * s0 + s1 * s1 + s2 * s2 + s3 * s3);
+      s0 *= recipNorm;
+      s1 *= recipNorm;
+      s2 *= recipNorm;
+      s3 *= recipNorm;
+
+      qDot1 -= beta * s0;
+      qDot2 -= beta * s1;
+      qDot3 -= beta * s2;
+      qDot4 -= beta * s3;
+    }
+
+    q0 += qDot1 * invSampleFreq;
+    q1 += qDot2 * invSampleFreq;
+    q2 += qDot3 * invSampleFreq;
+    q3 += qDot4 * invSampleFreq;
+
+    recipNorm = invSqrt(q0 * q0 + q1 * q1 + q2 * q2 + q3 * q3);
+    q0 *= recipNorm;
+    q1 *= recipNorm;
+    q2 *= recipNorm;
+    q3 *= recipNorm;
+  }
+};
+
+// ===============================
+// Trace generation
+// ===============================
+
+static uint32_t _rngState = 12345;
+
+// Roughly normal noise (sum of uniforms), deterministic across runs
+static double _noise(double sigma) {
+  double sum = 0.0;
+  for (int i = 0; i < 4; i++) {
+    _rngState = _rngState * 1664525u + 1013904223u;
+    sum += (_rngState >> 8) / 16777216.0 - 0.5;
+  }
+  return sum * sigma * 1.7320508;
+}
+
+// Body rates in deg/s at time t
+static void _bodyRates(double t, double w[3]) {
+  w[0] = w[1] = w[2] = 0.0;
+  if (t >= 2.0 && t < 6.0) {
+    w[2] = 90.0;                           // one full turn on the spot
+  }
+  else if (t >= 8.0 && t < 9.5) {
+    w[0] = 30.0;                           // roll over a bump...
+  }
+  else if (t >= 9.5 && t < 11.0) {
+    w[0] = -30.0;                          // ...and back
+  }
+  else if (t >= 13.0 && t < 15.0) {
+    w[1] = 20.0;                           // up a ramp...
+  }
+  else if (t >= 15.0 && t < 17.0) {
+    w[1] = -20.0;                          // ...and down
+  }
+  else if (t >= 20.0 && t < 40.0) {
+    w[0] = 25.0 * sin(t * 1.3);            // wobbling turns
+    w[1] = 20.0 * sin(t * 0.9 + 1.0);
+    w[2] = 120.0 * sin(t * 0.5);
+  }
+  else if (t >= 45.0 && t < 47.0) {
+    w[2] = -400.0;                         // fast spin
+  }
+}
+
+static void _buildTrace() {
+  const int samples = (int)(TRACE_SECONDS * SAMPLE_RATE_HZ);
+  const int substeps = 16;
+  const double dt = 1.0 / SAMPLE_RATE_HZ;
+  const double degToRad = M_PI / 180.0;
+
+  double q[4] = {1.0, 0.0, 0.0, 0.0};
+  _trace.reserve(samples);
+
+  for (int i = 0; i < samples; i++) {
+    double w[3];
+    _bodyRates(i * dt, w);
+
+    // Integrate the true orientation finely over this sample period
+    for (int s = 0; s < substeps; s++) {
+      double h = 0.5 * dt / substeps * degToRad;
+      double gx = w[0] * h, gy = w[1] * h, gz = w[2] * h;
+      double n0 = q[0] + (-q[1] * gx - q[2] * gy - q[3] * gz);
+      double n1 = q[1] + ( q[0] * gx + q[2] * gz - q[3] * gy);
+      double n2 = q[2] + ( q[0] * gy - q[1] * gz + q[3] * gx);
+      double n3 = q[3] + ( q[0] * gz + q[1] * gy - q[2] * gx);
+      double norm = sqrt(n0 * n0 + n1 * n1 + n2 * n2 + n3 * n3);
+      q[0] = n0 / norm;
+      q[1] = n1 / norm;
+      q[2] = n2 / norm;
+      q[3] = n3 / norm;
+    }
+
+    // Gravity in the sensor frame, in g
+    ImuSample sample;
+    sample.gx = (float)(w[0] + _noise(0.05));
+    sample.gy = (float)(w[1] + _noise(0.05));
+    sample.gz = (float)(w[2] + _noise(0.05));
+    sample.ax = (float)(2.0 * (q[1] * q[3] - q[0] * q[2]) + _noise(0.01));
+    sample.ay = (float)(2.0 * (q[0] * q[1] + q[2] * q[3]) + _noise(0.01));
+    sample.az = (float)(q[0] * q[0] - q[1] * q[1] - q[2] * q[2] + q[3] * q[3] + _noise(0.01));
+    for (int j = 0; j < 4; j++) {
+      sample.q[j] = q[j];
+    }
+    _trace.push_back(sample);
+  }
+}
+
+// Rotation angle between two orientations, in degrees. Both are normalized
+// first: acos near 1 turns a 1e-6 norm error into tenths of a degree
+static double _angleBetween(const double a[4], const float b[4]) {
+  double normA = sqrt(a[0] * a[0] + a[1] * a[1] + a[2] * a[2] + a[3] * a[3]);
+  double normB = sqrt((double)b[0] * b[0] + (double)b[1] * b[1] + (double)b[2] * b[2] + (double)b[3] * b[3]);
+  double dot = fabs(a[0] * b[0] + a[1] * b[1] + a[2] * b[2] + a[3] * b[3]) / (normA * normB);
+  if (dot > 1.0) {
+    dot = 1.0;
+  }
+  return 2.0 * acos(dot) * 180.0 / M_PI;
+}
+
+struct ReplayError {
+  double maxVsReference;
+  double maxVsTruth;
+  double rmsVsTruth;
+};
+
+static ReplayError _replay(OrientationFilter &filter) {
+  ReferenceMadgwick reference;
+  filter.begin(SAMPLE_RATE_HZ);
+  filter.reset();
+
+  ReplayError error = {0.0, 0.0, 0.0};
+  double sumSq = 0.0;
+  for (const ImuSample &s : _trace) {
+    reference.updateIMU(s.gx, s.gy, s.gz, s.ax, s.ay, s.az);
+    filter.updateIMU(s.gx, s.gy, s.gz, s.ax, s.ay, s.az);
+
+    float q[4];
+    filter.getQuaternion(q);
+    double ref[4] = {reference.q0, reference.q1, reference.q2, reference.q3};
+    double vsReference = _angleBetween(ref, q);
+    double vsTruth = _angleBetween(s.q, q);
+
+    if (vsReference > error.maxVsReference) {
+      error.maxVsReference = vsReference;
+    }
+    if (vsTruth > error.maxVsTruth) {
+      error.maxVsTruth = vsTruth;
+    }
+    sumSq += vsTruth * vsTruth;
+  }
+  error.rmsVsTruth = sqrt(sumSq / _trace.size());
+
+  printf("[AHRS] %-15s vs library max %.4f deg, vs truth max %.3f deg rms %.3f deg\n",
+      filter.name(), error.maxVsReference, error.maxVsTruth, error.rmsVsTruth);
+  return error;
+}
+
+template<typename Update>
+static double _nsPerUpdate(Update update) {
+  auto start = std::chrono::steady_clock::now();
+  for (int pass = 0; pass < BENCH_PASSES; pass++) {
+    for (const ImuSample &s : _trace) {
+      update(s);
+    }
+  }
+  auto elapsed = std::chrono::steady_clock::now() - start;
+  return std::chrono::duration<double, std::nano>(elapsed).count() / (BENCH_PASSES * _trace.size());
+}
+
+void setUp() {}
+void tearDown() {}
+
+// ===============================
+// Tests
+// ===============================
+
+void test_madgwick_matches_library() {
+  MadgwickFilter filter;
+  ReplayError error = _replay(filter);
+  TEST_ASSERT_LESS_THAN(0.01, error.maxVsReference);
+}
+
+void test_madgwick_fixed_matches_library() {
+  MadgwickFixedFilter filter;
+  ReplayError error = _replay(filter);
+  TEST_ASSERT_LESS_THAN(0.01, error.maxVsReference);
+}
+
+void test_mahony_tracks_truth() {
+  MahonyFilter filter;
+  ReplayError error = _replay(filter);
+  TEST_ASSERT_LESS_THAN(3.0, error.maxVsTruth);
+}
+
+void test_madgwick_tracks_truth() {
+  MadgwickFilter filter;
+  ReplayError error = _replay(filter);
+  TEST_ASSERT_LESS_THAN(3.0, error.maxVsTruth);
+}
+
+void test_yaw_only_integrates_z() {
+  YawOnlyFilter filter;
+  filter.begin(SAMPLE_RATE_HZ);
+
+  // Half a turn at 90 deg/s, starting from the 180 deg rest heading
+  for (int i = 0; i < (int)(2 * SAMPLE_RATE_HZ); i++) {
+    filter.updateIMU(0.0f, 0.0f, 90.0f, 0.0f, 0.0f, 1.0f);
+  }
+  TEST_ASSERT_FLOAT_WITHIN(0.1, 0.0, 180.0f - fabsf(filter.getYaw() - 180.0f));
+  TEST_ASSERT_FLOAT_WITHIN(1e-6, 0.0, filter.getRoll());
+}
+
+void test_euler_cache_refreshes_after_update() {
+  MadgwickFilter floatFilter;
+  MadgwickFixedFilter fixedFilter;
+  OrientationFilter *filters[] = {&floatFilter, &fixedFilter};
+
+  for (OrientationFilter *filter : filters) {
+    filter->begin(SAMPLE_RATE_HZ);
+    float yawAtRest = filter->getYaw();
+    for (int i = 0; i < (int)SAMPLE_RATE_HZ; i++) {
+      filter->updateIMU(0.0f, 0.0f, 45.0f, 0.0f, 0.0f, 1.0f);
+    }
+    TEST_ASSERT_FLOAT_WITHIN(0.5, yawAtRest + 45.0f, filter->getYaw());
+    TEST_ASSERT_FLOAT_WITHIN(0.1, 0.0, filter->getRoll());
+    TEST_ASSERT_FLOAT_WITHIN(0.1, 0.0, filter->getPitch());
+  }
+}
+
+void test_benchmark() {
+  ReferenceMadgwick reference;
+  MadgwickFilter madgwick;
+  MadgwickFixedFilter madgwickFixed;
+  MahonyFilter mahony;
+  YawOnlyFilter yawOnly;
+  OrientationFilter *filters[] = {&madgwick, &madgwickFixed, &mahony, &yawOnly};
+
+  // Read yaw after every update, as the IMU loop does for the euler output
+  float sink = 0.0f;
+  double referenceNs = _nsPerUpdate([&](const ImuSample &s) {
+    reference.updateIMU(s.gx, s.gy, s.gz, s.ax, s.ay, s.az);
+    sink += reference.q3;
+  });
+  printf("[AHRS] %-15s %7.1f ns/update (host)\n", "library", referenceNs);
+
+  for (OrientationFilter *filter : filters) {
+    filter->begin(SAMPLE_RATE_HZ);
+    double ns = _nsPerUpdate([&](const ImuSample &s) {
+      filter->updateIMU(s.gx, s.gy, s.gz, s.ax, s.ay, s.az);
+      sink += filter->getYaw();
+    });
+    printf("[AHRS] %-15s %7.1f ns/update (host, with getYaw)\n", filter->name(), ns);
+  }
+
+  TEST_ASSERT_TRUE(isfinite(sink));
+}
+
+int main() {
+  _buildTrace();
+
+  UNITY_BEGIN();
+  RUN_TEST(test_madgwick_matches_library);
+  RUN_TEST(test_madgwick_fixed_matches_library);
+  RUN_TEST(test_madgwick_tracks_truth);
+  RUN_TEST(test_mahony_tracks_truth);
+  RUN_TEST(test_yaw_only_integrates_z);
+  RUN_TEST(test_euler_cache_refreshes_after_update);
+  RUN_TEST(test_benchmark);
+  return UNITY_END();
+}
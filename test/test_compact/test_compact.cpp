@@ -0,0 +1,340 @@
+/*
+ * The compact payloads: varint and fixed point round trips, the precision each
+ * fixed point scale gives up, what encoding and decoding cost, and how much
+ * smaller a full frame gets.
+ *
+ * The decoders below are the host side of the protocol, written from the
+ * README. Timings are host timings, so only the ratios between them mean
+ * anything for the RP2040.
+ */
+
+#include <unity.h>
+
+#include <chrono>
+#include <limits.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "byteutils.h"
+#include "wpilibudp.h"
+
+using namespace wpilibudp;
+
+#define BENCH_ITERATIONS 2000000
+
+// ===============================
+// Host side decoders
+// ===============================
+
+static uint32_t _varintFromNetwork(const char* buf, int offset, int &len) {
+  uint32_t value = 0;
+  int shift = 0;
+  len = 0;
+  uint8_t byte;
+  do {
+    byte = buf[offset + len++];
+    value |= (uint32_t)(byte & 0x7F) << shift;
+    shift += 7;
+  } while (byte & 0x80);
+  return value;
+}
+
+static int32_t _zigzagVarintFromNetwork(const char* buf, int offset, int &len) {
+  uint32_t zigzag = _varintFromNetwork(buf, offset, len);
+  return (int32_t)(zigzag >> 1) ^ -(int32_t)(zigzag & 1);
+}
+
+// ===============================
+// Frame sizes
+// ===============================
+
+// Compact encoder entry: id, zigzag count, varint period + 1. Consecutive
+// encoders share one size and tag
+static int _compactEncoderEntrySize(int count, uint32_t period) {
+  char buf[16];
+  return 1 + zigzagVarintToNetwork(count, buf) + varintToNetwork(period + 1, buf);
+}
+
+// Compact IMU health: size, tag, state, varint errors, varint recoveries
+static int _compactImuHealthSize(uint16_t errors, uint16_t recoveries) {
+  char buf[16];
+  return 3 + varintToNetwork(errors, buf) + varintToNetwork(recoveries, buf);
+}
+
+// The frame main.cpp sends to a host that hasn't subscribed: device time, four
+// encoders, the button, gyro, accel, IMU health and the three analog inputs
+static int _frameSize(bool compact, int count, uint32_t period) {
+  int size = 3; // Datagram header
+  size += DeviceTimeMessage::size;
+  if (compact) {
+    size += 2 + 4 * _compactEncoderEntrySize(count, period);
+  }
+  else {
+    size += 4 * EncoderV2Message::size;
+  }
+  size += DioMessage::size;
+  size += compact ? CompactGyroMessage::size : GyroMessage::size;
+  size += compact ? CompactAccelMessage::size : AccelMessage::size;
+  size += compact ? _compactImuHealthSize(0, 0) : ImuHealthMessage::size;
+  size += 3 * (compact ? CompactAnalogMessage::size : AnalogMessage::size);
+  return size;
+}
+
+// ===============================
+// Fixed point scales
+// ===============================
+
+struct FixedPointField {
+  const char* name;
+  const char* unit;
+  float scale;
+  float range; // Largest magnitude the field carries
+};
+
+static const FixedPointField _fields[] = {
+  {"gyro rate", "deg/s", GYRO_RATE_FIXED_SCALE, 2000.0f},
+  {"angle", "deg", ANGLE_FIXED_SCALE, 360.0f},
+  {"accel", "g", ACCEL_FIXED_SCALE, 15.99f}, // +16 g is one step past the top
+  {"voltage", "V", VOLTAGE_FIXED_SCALE, 3.3f},
+  {"quaternion", "", QUATERNION_FIXED_SCALE, 1.0f},
+};
+
+template<typename Encode>
+static double _nsPerCall(Encode encode) {
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < BENCH_ITERATIONS; i++) {
+    encode(i);
+  }
+  auto elapsed = std::chrono::steady_clock::now() - start;
+  return std::chrono::duration<double, std::nano>(elapsed).count() / BENCH_ITERATIONS;
+}
+
+void setUp() {}
+void tearDown() {}
+
+// ===============================
+// Tests
+// ===============================
+
+void test_varint_round_trip() {
+  // Each pair is the largest value of a length and the smallest of the next
+  const uint32_t values[] = {0, 1, 127, 128, 16383, 16384, 2097151, 2097152,
+                             268435455, 268435456, UINT32_MAX};
+  const int sizes[] = {1, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5};
+
+  for (int i = 0; i < (int)(sizeof(values) / sizeof(values[0])); i++) {
+    char buf[8];
+    int written = varintToNetwork(values[i], buf, 1);
+    int read;
+    TEST_ASSERT_EQUAL_INT(sizes[i], written);
+    TEST_ASSERT_EQUAL_UINT32(values[i], _varintFromNetwork(buf, 1, read));
+    TEST_ASSERT_EQUAL_INT(written, read);
+  }
+}
+
+void test_zigzag_varint_round_trip() {
+  const int32_t values[] = {0, -1, 1, -64, 63, 64, -65, 8191, -8192, 8192,
+                            INT32_MAX, INT32_MIN};
+  const int sizes[] = {1, 1, 1, 1, 1, 2, 2, 2, 2, 3, 5, 5};
+
+  for (int i = 0; i < (int)(sizeof(values) / sizeof(values[0])); i++) {
+    char buf[8];
+    int written = zigzagVarintToNetwork(values[i], buf);
+    int read;
+    TEST_ASSERT_EQUAL_INT(sizes[i], written);
+    TEST_ASSERT_EQUAL_INT32(values[i], _zigzagVarintFromNetwork(buf, 0, read));
+    TEST_ASSERT_EQUAL_INT(written, read);
+  }
+
+  // Sweep, so no length boundary is missed
+  for (int64_t v = -70000; v <= 70000; v += 7) {
+    char buf[8];
+    int written = zigzagVarintToNetwork((int32_t)v, buf);
+    int read;
+    TEST_ASSERT_EQUAL_INT32(v, _zigzagVarintFromNetwork(buf, 0, read));
+    TEST_ASSERT_EQUAL_INT(written, read);
+  }
+}
+
+void test_fixed_point_precision() {
+  for (const FixedPointField &field : _fields) {
+    // Round to nearest, so the error is at most half a step over the range
+    double maxError = 0.0;
+    for (int i = -10000; i <= 10000; i++) {
+      float value = field.range * i / 10000.0f;
+      int16_t fixed = floatToFixedPoint(value, field.scale);
+
+      char buf[2];
+      toNetwork(fixed, buf, 0);
+      int16_t decoded;
+      fromNetwork(buf, 0, decoded);
+
+      double error = fabs((double)decoded / field.scale - value);
+      if (error > maxError) {
+        maxError = error;
+      }
+    }
+
+    printf("[COMPACT] %-10s step 1/%g, max error %.6f, range +-%.1f %s\n",
+        field.name, field.scale, maxError, 32767.0f / field.scale, field.unit);
+    TEST_ASSERT_LESS_OR_EQUAL(0.5 / field.scale * 1.001, maxError);
+    TEST_ASSERT_GREATER_THAN(field.range, 32767.0f / field.scale);
+  }
+}
+
+void test_fixed_point_saturates() {
+  TEST_ASSERT_EQUAL_INT16(32767, floatToFixedPoint(5000.0f, GYRO_RATE_FIXED_SCALE));
+  TEST_ASSERT_EQUAL_INT16(-32768, floatToFixedPoint(-5000.0f, GYRO_RATE_FIXED_SCALE));
+  TEST_ASSERT_EQUAL_INT16(32767, floatToFixedPoint(INFINITY, ACCEL_FIXED_SCALE));
+  TEST_ASSERT_EQUAL_INT16(-32768, floatToFixedPoint(-INFINITY, ACCEL_FIXED_SCALE));
+
+  // Rounds half away from zero, the same on both sides
+  TEST_ASSERT_EQUAL_INT16(1, floatToFixedPoint(0.5f / GYRO_RATE_FIXED_SCALE, GYRO_RATE_FIXED_SCALE));
+  TEST_ASSERT_EQUAL_INT16(-1, floatToFixedPoint(-0.5f / GYRO_RATE_FIXED_SCALE, GYRO_RATE_FIXED_SCALE));
+}
+
+void test_stopped_encoder_period_is_one_byte() {
+  // The period goes out as period + 1, so UINT_MAX wraps round to 0
+  char buf[8];
+  TEST_ASSERT_EQUAL_INT(1, varintToNetwork(UINT32_MAX + 1u, buf));
+  TEST_ASSERT_EQUAL_UINT8(0, buf[0]);
+
+  const uint32_t periods[] = {UINT32_MAX, 0, 1, (9000 << 1) | 1, UINT32_MAX - 1};
+  for (uint32_t period : periods) {
+    int len;
+    varintToNetwork(period + 1, buf);
+    TEST_ASSERT_EQUAL_UINT32(period, _varintFromNetwork(buf, 0, len) - 1);
+  }
+}
+
+void test_frame_size() {
+  // Encoder periods are in 16 cycle ticks with the direction in bit 0. A
+  // stopped or missing encoder reads UINT_MAX
+  struct {
+    const char* name;
+    int count;
+    uint32_t period;
+    int maxSize; // What the README gives
+  } cases[] = {
+    {"stopped", 0, UINT32_MAX, 78},
+    {"driving", -5000, (9000 << 1) | 1, 90},
+    {"long run", 200000, (60000 << 1), 94},
+  };
+
+  int legacy = _frameSize(false, 0, 0);
+  TEST_ASSERT_EQUAL_INT(134, legacy);
+  for (const auto &c : cases) {
+    int compact = _frameSize(true, c.count, c.period);
+    float saved = 100.0f * (legacy - compact) / legacy;
+    printf("[COMPACT] frame %-8s version 2 %d bytes, compact %d bytes (%.1f%% smaller)%s\n",
+        c.name, legacy, compact, saved, (2 * compact > legacy) ? ", short of half" : "");
+
+    TEST_ASSERT_LESS_OR_EQUAL(c.maxSize, compact);
+  }
+}
+
+void test_encode_cost() {
+  char buf[64];
+  float values[3] = {12.5f, -3.25f, 181.0f};
+  int sink = 0;
+
+  double floatNs = _nsPerCall([&](int i) {
+    values[0] = (float)(i & 0xFF);
+    sink += GyroMessage::encode(buf, 0, values, values);
+    sink += buf[5];
+  });
+  double fixedNs = _nsPerCall([&](int i) {
+    values[0] = (float)(i & 0xFF);
+    int16_t rates[3];
+    int16_t angles[3];
+    for (int j = 0; j < 3; j++) {
+      rates[j] = floatToFixedPoint(values[j], GYRO_RATE_FIXED_SCALE);
+      angles[j] = floatToFixedPoint(values[j], ANGLE_FIXED_SCALE);
+    }
+    sink += CompactGyroMessage::encode(buf, 0, rates, angles);
+    sink += buf[5];
+  });
+  printf("[COMPACT] gyro encode: float %.1f ns, fixed point %.1f ns (host)\n", floatNs, fixedNs);
+
+  double legacyEncoderNs = _nsPerCall([&](int i) {
+    sink += EncoderV2Message::encode(buf, 0, 0, i - 1000, (uint32_t)i * 3);
+    sink += buf[5];
+  });
+  double varintEncoderNs = _nsPerCall([&](int i) {
+    int len = 3;
+    len += zigzagVarintToNetwork(i - 1000, buf, len);
+    len += varintToNetwork((uint32_t)i * 3 + 1, buf, len);
+    sink += len + buf[5];
+  });
+  printf("[COMPACT] encoder encode: fixed %.1f ns, varint %.1f ns (host)\n", legacyEncoderNs, varintEncoderNs);
+
+  TEST_ASSERT_TRUE(sink != 0);
+}
+
+void test_decode_cost() {
+  // A ring of encoded messages, so the loops can't be folded into one decode
+  const int ring = 64;
+  char floatGyro[ring][GyroMessage::size];
+  char fixedGyro[ring][CompactGyroMessage::size];
+  char legacyEncoder[ring][EncoderV2Message::size];
+  char varintEncoder[ring][16];
+  for (int i = 0; i < ring; i++) {
+    float values[3] = {12.5f * i, -3.25f, 181.0f};
+    int16_t fixed[3] = {(int16_t)(200 * i), -52, 9050};
+    GyroMessage::encode(floatGyro[i], 0, values, values);
+    CompactGyroMessage::encode(fixedGyro[i], 0, fixed, fixed);
+    EncoderV2Message::encode(legacyEncoder[i], 0, 0, i * 977 - 30000, (uint32_t)i * 3001);
+    int len = 3;
+    len += zigzagVarintToNetwork(i * 977 - 30000, varintEncoder[i], len);
+    varintToNetwork((uint32_t)i * 3001 + 1, varintEncoder[i], len);
+  }
+  double sink = 0;
+
+  double floatNs = _nsPerCall([&](int i) {
+    float rates[3];
+    float angles[3];
+    GyroMessage::decode(floatGyro[i % ring], 1, rates, angles);
+    sink += rates[0] + angles[2];
+  });
+  double fixedNs = _nsPerCall([&](int i) {
+    int16_t fixedRates[3];
+    int16_t fixedAngles[3];
+    CompactGyroMessage::decode(fixedGyro[i % ring], 1, fixedRates, fixedAngles);
+    sink += fixedRates[0] / GYRO_RATE_FIXED_SCALE + fixedAngles[2] / ANGLE_FIXED_SCALE;
+  });
+  printf("[COMPACT] gyro decode: float %.1f ns, fixed point %.1f ns (host)\n", floatNs, fixedNs);
+
+  double legacyEncoderNs = _nsPerCall([&](int i) {
+    uint8_t id;
+    int32_t count;
+    uint32_t period;
+    EncoderV2Message::decode(legacyEncoder[i % ring], 1, id, count, period);
+    sink += count + period;
+  });
+  double varintEncoderNs = _nsPerCall([&](int i) {
+    const char* buf = varintEncoder[i % ring];
+    int len;
+    int offset = 3;
+    int32_t count = _zigzagVarintFromNetwork(buf, offset, len);
+    offset += len;
+    uint32_t period = _varintFromNetwork(buf, offset, len) - 1;
+    sink += count + period;
+  });
+  printf("[COMPACT] encoder decode: fixed %.1f ns, varint %.1f ns (host)\n", legacyEncoderNs, varintEncoderNs);
+
+  TEST_ASSERT_TRUE(sink != 0);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_varint_round_trip);
+  RUN_TEST(test_zigzag_varint_round_trip);
+  RUN_TEST(test_fixed_point_precision);
+  RUN_TEST(test_fixed_point_saturates);
+  RUN_TEST(test_stopped_encoder_period_is_one_byte);
+  RUN_TEST(test_frame_size);
+  RUN_TEST(test_encode_cost);
+  RUN_TEST(test_decode_cost);
+  return UNITY_END();
+}
@@ -0,0 +1,229 @@
+/*
+ * Event hysteresis, rate limiting and the collision guards, with the robot,
+ * IMU and clock faked below.
+ */
+
+#include <unity.h>
+
+#include <stdint.h>
+
+// Built in here rather than through build_src_filter, so the other tests don't
+// need the fakes
+#include "../../src/events.cpp"
+
+using namespace xrp;
+
+// ===============================
+// Fakes
+// ===============================
+
+static unsigned long _nowUs;
+static bool _button;
+static AnalogReading _lineLeft;
+static AnalogReading _range;
+static bool _imuReady;
+static ImuHealth _imuHealth;
+static float _accel[3];
+
+unsigned long micros() { return _nowUs; }
+unsigned long millis() { return _nowUs / 1000; }
+
+namespace xrp {
+
+bool isUserButtonPressed() { return _button; }
+bool reflectanceInitialized() { return true; }
+AnalogReading getReflectanceLeft() { return _lineLeft; }
+AnalogReading getReflectanceRight() { return {0.0f, 0, false}; }
+bool rangefinderInitialized() { return true; }
+AnalogReading getRangefinder() { return _range; }
+
+bool imuIsReady() { return _imuReady; }
+ImuHealthInfo imuGetHealth() { return {_imuHealth, 0, 0}; }
+float imuGetAccelX() { return _accel[0]; }
+float imuGetAccelY() { return _accel[1]; }
+float imuGetAccelZ() { return _accel[2]; }
+
+} // namespace xrp
+
+#define LINE_LEFT_BIT (1 << (int)RobotEvent::LINE_LEFT)
+#define RANGE_NEAR_BIT (1 << (int)RobotEvent::RANGE_NEAR)
+#define COLLISION_BIT (1 << (int)RobotEvent::COLLISION)
+#define BUTTON_BIT (1 << (int)RobotEvent::BUTTON)
+
+// Polls after the rate limit has passed
+static uint32_t _pollLater() {
+  _nowUs += EVENT_MIN_INTERVAL_US;
+  return eventsPoll();
+}
+
+static void _setAccel(float x, float y, float z) {
+  _accel[0] = x;
+  _accel[1] = y;
+  _accel[2] = z;
+}
+
+void setUp() {
+  _nowUs = 1000000;
+  _button = false;
+  _lineLeft = {0.0f, 0, true};
+  _range = {3.0f, 0, true};
+  _imuReady = true;
+  _imuHealth = ImuHealth::OK;
+  _setAccel(0.0f, 0.0f, 1.0f);
+  eventsReset();
+}
+
+void tearDown() {}
+
+// ===============================
+// Tests
+// ===============================
+
+void test_only_the_button_by_default() {
+  _lineLeft.voltage = 4.0f;
+  _range.voltage = 0.0f;
+  _setAccel(0.0f, 0.0f, 5.0f);
+  TEST_ASSERT_EQUAL_UINT32(0, _pollLater());
+
+  _button = true;
+  TEST_ASSERT_EQUAL_UINT32(BUTTON_BIT, _pollLater());
+  TEST_ASSERT_TRUE(eventsGetState(RobotEvent::BUTTON).active);
+  TEST_ASSERT_EQUAL_UINT32(_nowUs, eventsGetState(RobotEvent::BUTTON).timeUs);
+}
+
+void test_line_hysteresis() {
+  TEST_ASSERT_TRUE(eventsSubscribe((uint8_t)RobotEvent::LINE_LEFT, true, 2.0f));
+
+  _lineLeft.voltage = 1.95f;
+  TEST_ASSERT_EQUAL_UINT32(0, _pollLater());
+
+  _lineLeft.voltage = 2.05f;
+  TEST_ASSERT_EQUAL_UINT32(LINE_LEFT_BIT, _pollLater());
+  TEST_ASSERT_FLOAT_WITHIN(1e-6f, 2.05f, eventsGetState(RobotEvent::LINE_LEFT).value);
+
+  // Back under the threshold, but not by the hysteresis
+  _lineLeft.voltage = 2.0f - EVENT_LINE_HYSTERESIS_V + 0.01f;
+  TEST_ASSERT_EQUAL_UINT32(0, _pollLater());
+  TEST_ASSERT_TRUE(eventsGetState(RobotEvent::LINE_LEFT).active);
+
+  _lineLeft.voltage = 2.0f - EVENT_LINE_HYSTERESIS_V - 0.01f;
+  TEST_ASSERT_EQUAL_UINT32(LINE_LEFT_BIT, _pollLater());
+  TEST_ASSERT_FALSE(eventsGetState(RobotEvent::LINE_LEFT).active);
+
+  // And has to get back over the threshold itself to set again
+  _lineLeft.voltage = 1.95f;
+  TEST_ASSERT_EQUAL_UINT32(0, _pollLater());
+}
+
+void test_range_hysteresis() {
+  TEST_ASSERT_TRUE(eventsSubscribe((uint8_t)RobotEvent::RANGE_NEAR, true, 1.0f));
+
+  _range.voltage = 0.95f;
+  TEST_ASSERT_EQUAL_UINT32(RANGE_NEAR_BIT, _pollLater());
+
+  _range.voltage = 1.0f + EVENT_RANGE_HYSTERESIS_V - 0.01f;
+  TEST_ASSERT_EQUAL_UINT32(0, _pollLater());
+
+  _range.voltage = 1.0f + EVENT_RANGE_HYSTERESIS_V + 0.01f;
+  TEST_ASSERT_EQUAL_UINT32(RANGE_NEAR_BIT, _pollLater());
+  TEST_ASSERT_FALSE(eventsGetState(RobotEvent::RANGE_NEAR).active);
+}
+
+void test_invalid_readings_are_ignored() {
+  TEST_ASSERT_TRUE(eventsSubscribe((uint8_t)RobotEvent::LINE_LEFT, true, 2.0f));
+
+  _lineLeft = {4.0f, 500, false};
+  TEST_ASSERT_EQUAL_UINT32(0, _pollLater());
+
+  _lineLeft.valid = true;
+  TEST_ASSERT_EQUAL_UINT32(LINE_LEFT_BIT, _pollLater());
+
+  // A sensor dropping out holds the event where it was
+  _lineLeft = {0.0f, 500, false};
+  TEST_ASSERT_EQUAL_UINT32(0, _pollLater());
+  TEST_ASSERT_TRUE(eventsGetState(RobotEvent::LINE_LEFT).active);
+}
+
+void test_collision_hysteresis() {
+  TEST_ASSERT_TRUE(eventsSubscribe((uint8_t)RobotEvent::COLLISION, true, 0.5f));
+
+  _setAccel(0.0f, 0.0f, 1.4f);
+  TEST_ASSERT_EQUAL_UINT32(0, _pollLater());
+
+  // 0.6 g away from 1 g, in any direction
+  _setAccel(0.0f, 1.6f, 0.0f);
+  TEST_ASSERT_EQUAL_UINT32(COLLISION_BIT, _pollLater());
+  TEST_ASSERT_FLOAT_WITHIN(1e-5f, 0.6f, eventsGetState(RobotEvent::COLLISION).value);
+
+  // Clears below half the threshold
+  _setAccel(0.0f, 0.0f, 1.0f + 0.5f * EVENT_COLLISION_CLEAR_RATIO + 0.01f);
+  TEST_ASSERT_EQUAL_UINT32(0, _pollLater());
+  _setAccel(0.0f, 0.0f, 1.0f + 0.5f * EVENT_COLLISION_CLEAR_RATIO - 0.01f);
+  TEST_ASSERT_EQUAL_UINT32(COLLISION_BIT, _pollLater());
+}
+
+void test_collision_needs_live_imu_readings() {
+  TEST_ASSERT_TRUE(eventsSubscribe((uint8_t)RobotEvent::COLLISION, true, 0.5f));
+
+  // A zero accel is 1 g away from 1 g, but only means there's no sample yet
+  _setAccel(0.0f, 0.0f, 0.0f);
+  TEST_ASSERT_EQUAL_UINT32(0, _pollLater());
+
+  _setAccel(0.0f, 0.0f, 2.0f);
+  _imuReady = false;
+  TEST_ASSERT_EQUAL_UINT32(0, _pollLater());
+
+  _imuReady = true;
+  _imuHealth = ImuHealth::RECOVERING;
+  TEST_ASSERT_EQUAL_UINT32(0, _pollLater());
+  _imuHealth = ImuHealth::OFFLINE;
+  TEST_ASSERT_EQUAL_UINT32(0, _pollLater());
+
+  _imuHealth = ImuHealth::DEGRADED;
+  TEST_ASSERT_EQUAL_UINT32(COLLISION_BIT, _pollLater());
+}
+
+void test_changes_are_rate_limited() {
+  TEST_ASSERT_TRUE(eventsSubscribe((uint8_t)RobotEvent::LINE_LEFT, true, 2.0f));
+
+  _lineLeft.voltage = 3.0f;
+  TEST_ASSERT_EQUAL_UINT32(LINE_LEFT_BIT, _pollLater());
+
+  // Clearing straight away is held until the interval has passed
+  _lineLeft.voltage = 0.0f;
+  _nowUs += EVENT_MIN_INTERVAL_US - 1;
+  TEST_ASSERT_EQUAL_UINT32(0, eventsPoll());
+  _nowUs += 1;
+  TEST_ASSERT_EQUAL_UINT32(LINE_LEFT_BIT, eventsPoll());
+}
+
+void test_subscribe_reports_a_condition_that_already_holds() {
+  TEST_ASSERT_TRUE(eventsSubscribe((uint8_t)RobotEvent::LINE_LEFT, true, 2.0f));
+  _lineLeft.voltage = 3.0f;
+  TEST_ASSERT_EQUAL_UINT32(LINE_LEFT_BIT, _pollLater());
+
+  // Subscribing again (new threshold) starts from inactive
+  TEST_ASSERT_TRUE(eventsSubscribe((uint8_t)RobotEvent::LINE_LEFT, true, 2.5f));
+  TEST_ASSERT_FALSE(eventsGetState(RobotEvent::LINE_LEFT).active);
+  TEST_ASSERT_EQUAL_UINT32(LINE_LEFT_BIT, eventsPoll());
+
+  // Unsubscribed events are not polled
+  TEST_ASSERT_TRUE(eventsSubscribe((uint8_t)RobotEvent::LINE_LEFT, false, 2.5f));
+  _lineLeft.voltage = 0.0f;
+  TEST_ASSERT_EQUAL_UINT32(0, _pollLater());
+
+  TEST_ASSERT_FALSE(eventsSubscribe((uint8_t)RobotEvent::COUNT, true, 0.0f));
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_only_the_button_by_default);
+  RUN_TEST(test_line_hysteresis);
+  RUN_TEST(test_range_hysteresis);
+  RUN_TEST(test_invalid_readings_are_ignored);
+  RUN_TEST(test_collision_hysteresis);
+  RUN_TEST(test_collision_needs_live_imu_readings);
+  RUN_TEST(test_changes_are_rate_limited);
+  RUN_TEST(test_subscribe_reports_a_condition_that_already_holds);
+  return UNITY_END();
+}
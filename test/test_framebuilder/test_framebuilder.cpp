@@ -0,0 +1,366 @@
+/*
+ * Datagram splitting in FrameBuilder, and how it folds compact encoders together.
+ *
+ * The message writers live in wpilibudp.cpp, which needs the robot, so they are
+ * faked below. Each fake writes a well formed [size][tag][payload] message at
+ * its size table entry (the descriptor at whatever size a test asks for), which
+ * is the worst case the builder has to split for.
+ */
+
+#include <unity.h>
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// Built in here rather than through build_src_filter, so the other tests don't
+// need the fake writers
+#include "../../src/framebuilder.cpp"
+
+using namespace wpilibudp;
+
+// ===============================
+// Fake writers
+// ===============================
+
+static int _descriptorSize = XRP_MSG_SIZE_DESCRIPTOR;
+static int _historyPending = 0;
+static bool _compact = false;
+
+// Compact encoder entries are id, count, period at their shortest
+#define COMPACT_ENCODER_ENTRY_SIZE 3
+
+static int _fakeMessage(uint8_t tag, int size, char* buffer, int offset) {
+  buffer[offset] = size - 1;
+  buffer[offset + 1] = tag;
+  memset(buffer + offset + 2, tag, size - 2);
+  return size;
+}
+
+namespace wpilibudp {
+
+int writeDescriptorData(const char*, int, char* buffer, int offset) {
+  return _fakeMessage(XRP_TAG_DESCRIPTOR, _descriptorSize, buffer, offset);
+}
+bool sessionCompact() {
+  return _compact;
+}
+
+int writeEncoderData(int deviceId, int count, unsigned period, unsigned, char* buffer, int offset) {
+  if (_compact) {
+    buffer[offset] = COMPACT_ENCODER_ENTRY_SIZE + 1;
+    buffer[offset + 1] = XRP_TAG_ENCODER;
+    buffer[offset + 2] = deviceId;
+    buffer[offset + 3] = count;
+    buffer[offset + 4] = period;
+    return COMPACT_ENCODER_ENTRY_SIZE + 2;
+  }
+  return _fakeMessage(XRP_TAG_ENCODER, XRP_MSG_SIZE_ENCODER, buffer, offset);
+}
+int writeDIOData(int, bool, char* buffer, int offset) {
+  return _fakeMessage(XRP_TAG_DIO, XRP_MSG_SIZE_DIO, buffer, offset);
+}
+int writeGyroData(float[3], float[3], char* buffer, int offset) {
+  return _fakeMessage(XRP_TAG_GYRO, XRP_MSG_SIZE_GYRO, buffer, offset);
+}
+int writeAccelData(float[3], char* buffer, int offset) {
+  return _fakeMessage(XRP_TAG_ACCEL, XRP_MSG_SIZE_ACCEL, buffer, offset);
+}
+int writeAnalogData(int, float, uint16_t, bool, char* buffer, int offset) {
+  return _fakeMessage(XRP_TAG_ANALOG, XRP_MSG_SIZE_ANALOG, buffer, offset);
+}
+int writeMotorStateData(int, float, float, char* buffer, int offset) {
+  return _fakeMessage(XRP_TAG_MOTOR_STATE, XRP_MSG_SIZE_MOTOR_STATE, buffer, offset);
+}
+int writeQuaternionData(float[4], float[3], char* buffer, int offset) {
+  return _fakeMessage(XRP_TAG_QUATERNION, XRP_MSG_SIZE_QUATERNION, buffer, offset);
+}
+int writeDeviceTimeData(uint32_t, char* buffer, int offset) {
+  return _fakeMessage(XRP_TAG_DEVICE_TIME, XRP_MSG_SIZE_DEVICE_TIME, buffer, offset);
+}
+int writeEventData(uint8_t, bool, uint32_t, float, char* buffer, int offset) {
+  return _fakeMessage(XRP_TAG_EVENT, XRP_MSG_SIZE_EVENT, buffer, offset);
+}
+int writeImuHealthData(uint8_t, uint16_t, uint16_t, char* buffer, int offset) {
+  return _fakeMessage(XRP_TAG_IMU_HEALTH, XRP_MSG_SIZE_IMU_HEALTH, buffer, offset);
+}
+
+// Whole samples only, like the real one
+int writeHistoryResponses(char* buffer, int offset, int maxLen) {
+  int len = 0;
+  while (_historyPending > 0 && len + XRP_MSG_SIZE_HISTORY_SAMPLE <= maxLen) {
+    len += _fakeMessage(XRP_TAG_HISTORY_SAMPLE, XRP_MSG_SIZE_HISTORY_SAMPLE, buffer, offset + len);
+    _historyPending--;
+  }
+  return len;
+}
+
+} // namespace wpilibudp
+
+// ===============================
+// Sent datagrams
+// ===============================
+
+static std::vector<std::string> _sent;
+static uint16_t _seq;
+
+static void _capture(const char* data, int len) {
+  _sent.push_back(std::string(data, len));
+}
+
+// Walks the messages after the header. Returns the tags, or fails the test if a
+// message runs past the end of the datagram
+static std::vector<uint8_t> _tags(const std::string &datagram) {
+  std::vector<uint8_t> tags;
+  size_t i = FRAME_HEADER_SIZE;
+  while (i < datagram.size()) {
+    size_t size = (uint8_t)datagram[i] + 1;
+    TEST_ASSERT_TRUE_MESSAGE(i + size <= datagram.size(), "Message runs past the end of the datagram");
+    tags.push_back((uint8_t)datagram[i + 1]);
+    i += size;
+  }
+  return tags;
+}
+
+// One of every outbound message, in the order main.cpp sends them
+static void _addFullFrame(FrameBuilder &frame) {
+  float v3[3] = {0, 0, 0};
+  float v4[4] = {1, 0, 0, 0};
+
+  frame.addDeviceTime(0);
+  frame.addDescriptor("", 0);
+  for (int i = 0; i < 4; i++) {
+    frame.addEncoder(i, 0, 0, 1);
+  }
+  frame.addDIO(0, false);
+  frame.addGyro(v3, v3);
+  frame.addQuaternion(v4, v3);
+  frame.addAccel(v3);
+  frame.addImuHealth(0, 0, 0);
+  for (int i = 0; i < 3; i++) {
+    frame.addAnalog(i, 0, 0, true);
+  }
+  for (int i = 0; i < 4; i++) {
+    frame.addMotorState(i, 0, 0);
+  }
+  frame.addEvent(0, true, 0, 0);
+  frame.addHistoryResponses();
+}
+
+#define FULL_FRAME_MESSAGES 19
+
+void setUp() {
+  _sent.clear();
+  _seq = 0;
+  _descriptorSize = XRP_MSG_SIZE_DESCRIPTOR;
+  _historyPending = 0;
+  _compact = false;
+}
+
+void tearDown() {}
+
+// ===============================
+// Tests
+// ===============================
+
+void test_mtu_is_clamped() {
+  FrameBuilder frame{_capture, _seq};
+  TEST_ASSERT_EQUAL_INT(FRAME_DEFAULT_MTU, frame.getMtu());
+
+  frame.setMtu(0);
+  TEST_ASSERT_EQUAL_INT(FRAME_MIN_MTU, frame.getMtu());
+  frame.setMtu(9000);
+  TEST_ASSERT_EQUAL_INT(FRAME_MAX_MTU, frame.getMtu());
+  frame.setMtu(700);
+  TEST_ASSERT_EQUAL_INT(700, frame.getMtu());
+}
+
+void test_empty_frame_sends_nothing() {
+  FrameBuilder frame{_capture, _seq};
+  frame.flush();
+  frame.addHistoryResponses();
+  frame.flush();
+
+  TEST_ASSERT_EQUAL_INT(0, _sent.size());
+  TEST_ASSERT_EQUAL_UINT16(0, _seq);
+}
+
+void test_full_frame_fits_default_mtu() {
+  FrameBuilder frame{_capture, _seq};
+  _addFullFrame(frame);
+  frame.flush();
+
+  TEST_ASSERT_EQUAL_INT(1, _sent.size());
+  TEST_ASSERT_EQUAL_INT(FULL_FRAME_MESSAGES, _tags(_sent[0]).size());
+  TEST_ASSERT_EQUAL_UINT16(1, _seq);
+}
+
+void test_split_at_min_mtu() {
+  FrameBuilder frame{_capture, _seq};
+  frame.setMtu(FRAME_MIN_MTU);
+  _addFullFrame(frame);
+  frame.flush();
+
+  TEST_ASSERT_GREATER_THAN(1, _sent.size());
+
+  size_t messages = 0;
+  for (size_t i = 0; i < _sent.size(); i++) {
+    const std::string &datagram = _sent[i];
+    TEST_ASSERT_LESS_OR_EQUAL(FRAME_MIN_MTU, datagram.size());
+
+    // Every datagram has its own sequence number, and the control byte unset
+    TEST_ASSERT_EQUAL_UINT16(i, networkToUInt16((char*)datagram.data()));
+    TEST_ASSERT_EQUAL_UINT8(0, datagram[2]);
+
+    size_t count = _tags(datagram).size();
+    TEST_ASSERT_GREATER_THAN(0, count);
+    messages += count;
+  }
+
+  TEST_ASSERT_EQUAL_INT(FULL_FRAME_MESSAGES, messages);
+  TEST_ASSERT_EQUAL_UINT16(_sent.size(), _seq);
+  TEST_ASSERT_EQUAL_UINT32(0, frame.getDroppedCount());
+}
+
+void test_split_keeps_message_order() {
+  FrameBuilder frame{_capture, _seq};
+  frame.setMtu(FRAME_MIN_MTU);
+  _addFullFrame(frame);
+  frame.flush();
+
+  std::vector<uint8_t> tags;
+  for (const std::string &datagram : _sent) {
+    std::vector<uint8_t> t = _tags(datagram);
+    tags.insert(tags.end(), t.begin(), t.end());
+  }
+
+  _sent.clear();
+  FrameBuilder single{_capture, _seq};
+  _addFullFrame(single);
+  single.flush();
+
+  TEST_ASSERT_TRUE(tags == _tags(_sent[0]));
+}
+
+void test_history_responses_fill_remaining_space() {
+  FrameBuilder frame{_capture, _seq};
+  frame.setMtu(FRAME_MIN_MTU);
+
+  // Six samples fit after the header, the rest carry over
+  _historyPending = 10;
+  frame.addHistoryResponses();
+  frame.flush();
+  TEST_ASSERT_EQUAL_INT(1, _sent.size());
+  TEST_ASSERT_EQUAL_INT((FRAME_MIN_MTU - FRAME_HEADER_SIZE) / XRP_MSG_SIZE_HISTORY_SAMPLE, _tags(_sent[0]).size());
+  TEST_ASSERT_EQUAL_INT(10 - (FRAME_MIN_MTU - FRAME_HEADER_SIZE) / XRP_MSG_SIZE_HISTORY_SAMPLE, _historyPending);
+
+  // Too little room left for a sample starts a new datagram
+  while (frame.remaining() >= XRP_MSG_SIZE_HISTORY_SAMPLE) {
+    frame.addDIO(0, true);
+  }
+  frame.addHistoryResponses();
+  frame.flush();
+  TEST_ASSERT_EQUAL_INT(3, _sent.size());
+  TEST_ASSERT_EQUAL_INT(0, _historyPending);
+  for (uint8_t tag : _tags(_sent[2])) {
+    TEST_ASSERT_EQUAL_UINT8(XRP_TAG_HISTORY_SAMPLE, tag);
+  }
+}
+
+void test_largest_descriptor_is_kept() {
+  FrameBuilder frame{_capture, _seq};
+  frame.setMtu(FRAME_MIN_MTU);
+  frame.addDescriptor("", 0);
+  frame.flush();
+
+  TEST_ASSERT_EQUAL_INT(1, _sent.size());
+  TEST_ASSERT_EQUAL_INT(FRAME_HEADER_SIZE + XRP_MSG_SIZE_DESCRIPTOR, _sent[0].size());
+  TEST_ASSERT_EQUAL_UINT32(0, frame.getDroppedCount());
+}
+
+void test_oversized_message_is_dropped() {
+  FrameBuilder frame{_capture, _seq};
+  frame.setMtu(FRAME_MIN_MTU);
+  frame.addDeviceTime(0);
+
+  // Longer than its size table entry, and longer than the space left
+  _descriptorSize = FRAME_MIN_MTU;
+  frame.addDescriptor("", 0);
+  TEST_ASSERT_EQUAL_UINT32(1, frame.getDroppedCount());
+
+  // The next message goes where the dropped one would have been
+  frame.addDIO(0, true);
+  frame.flush();
+
+  TEST_ASSERT_EQUAL_INT(1, _sent.size());
+  std::vector<uint8_t> tags = _tags(_sent[0]);
+  TEST_ASSERT_EQUAL_INT(2, tags.size());
+  TEST_ASSERT_EQUAL_UINT8(XRP_TAG_DEVICE_TIME, tags[0]);
+  TEST_ASSERT_EQUAL_UINT8(XRP_TAG_DIO, tags[1]);
+  TEST_ASSERT_EQUAL_INT(FRAME_HEADER_SIZE + XRP_MSG_SIZE_DEVICE_TIME + XRP_MSG_SIZE_DIO, _sent[0].size());
+}
+
+void test_compact_encoders_share_a_message() {
+  FrameBuilder frame{_capture, _seq};
+  _compact = true;
+  frame.addDeviceTime(0);
+  for (int i = 0; i < 4; i++) {
+    frame.addEncoder(i, 10 + i, 20 + i, 1);
+  }
+  frame.addDIO(0, false);
+  frame.addEncoder(3, 13, 23, 1);
+  frame.flush();
+
+  TEST_ASSERT_EQUAL_INT(1, _sent.size());
+  std::vector<uint8_t> tags = _tags(_sent[0]);
+  TEST_ASSERT_EQUAL_INT(4, tags.size());
+  TEST_ASSERT_EQUAL_UINT8(XRP_TAG_ENCODER, tags[1]);
+  TEST_ASSERT_EQUAL_UINT8(XRP_TAG_DIO, tags[2]);
+  TEST_ASSERT_EQUAL_UINT8(XRP_TAG_ENCODER, tags[3]);
+
+  // The four in a row are entries of one message, in the order they were added
+  const char* run = _sent[0].data() + FRAME_HEADER_SIZE + XRP_MSG_SIZE_DEVICE_TIME;
+  TEST_ASSERT_EQUAL_UINT8(1 + 4 * COMPACT_ENCODER_ENTRY_SIZE, run[0]);
+  for (int i = 0; i < 4; i++) {
+    const char* entry = run + 2 + i * COMPACT_ENCODER_ENTRY_SIZE;
+    TEST_ASSERT_EQUAL_INT(i, entry[0]);
+    TEST_ASSERT_EQUAL_INT(10 + i, entry[1]);
+    TEST_ASSERT_EQUAL_INT(20 + i, entry[2]);
+  }
+}
+
+void test_compact_encoders_split_into_whole_messages() {
+  FrameBuilder frame{_capture, _seq};
+  frame.setMtu(FRAME_MIN_MTU);
+  _compact = true;
+
+  // Fill up to the point where the next encoder starts a new datagram
+  frame.addEncoder(0, 0, 0, 1);
+  while (frame.remaining() >= XRP_MSG_SIZE_ENCODER) {
+    frame.addDIO(0, false);
+  }
+  frame.addEncoder(0, 0, 0, 1);
+  frame.addEncoder(1, 0, 0, 1);
+  frame.flush();
+
+  TEST_ASSERT_EQUAL_INT(2, _sent.size());
+  std::vector<uint8_t> tags = _tags(_sent[1]);
+  TEST_ASSERT_EQUAL_INT(1, tags.size());
+  TEST_ASSERT_EQUAL_UINT8(XRP_TAG_ENCODER, tags[0]);
+  TEST_ASSERT_EQUAL_INT(FRAME_HEADER_SIZE + 2 + 2 * COMPACT_ENCODER_ENTRY_SIZE, _sent[1].size());
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_mtu_is_clamped);
+  RUN_TEST(test_empty_frame_sends_nothing);
+  RUN_TEST(test_full_frame_fits_default_mtu);
+  RUN_TEST(test_split_at_min_mtu);
+  RUN_TEST(test_split_keeps_message_order);
+  RUN_TEST(test_history_responses_fill_remaining_space);
+  RUN_TEST(test_largest_descriptor_is_kept);
+  RUN_TEST(test_oversized_message_is_dropped);
+  RUN_TEST(test_compact_encoders_share_a_message);
+  RUN_TEST(test_compact_encoders_split_into_whole_messages);
+  return UNITY_END();
+}
@@ -0,0 +1,366 @@
+/*
+ * Sensor history: recording, point queries (exact, interpolated and clamped)
+ * and paging through a window while the ring keeps filling.
+ */
+
+#include <unity.h>
+
+#include <stdint.h>
+#include <string.h>
+
+// Built in here rather than through build_src_filter, so setUp can empty the
+// rings between tests
+#include "../../src/history.cpp"
+
+using namespace xrp;
+
+#define ENCODER ((uint8_t)HistorySensor::ENCODER_0)
+#define ANGLE ((uint8_t)HistorySensor::GYRO_ANGLE)
+#define ACCEL_SENSOR ((uint8_t)HistorySensor::ACCEL)
+
+static void _record(HistorySensor sensor, uint32_t timeUs, float a, float b = 0, float c = 0) {
+  float values[HISTORY_MAX_FIELDS] = {a, b, c};
+  historyRecord(sensor, timeUs, values);
+}
+
+// One sample per record period from startUs, with the index as the value
+static void _recordRun(uint32_t startUs, int first, int count) {
+  for (int i = first; i < first + count; i++) {
+    _record(HistorySensor::ENCODER_0, startUs + i * HISTORY_RECORD_PERIOD_US, (float)i, (float)-i);
+  }
+}
+
+void setUp() {
+  memset(_history, 0, sizeof(_history));
+}
+
+void tearDown() {}
+
+// ===============================
+// Recording
+// ===============================
+
+void test_field_counts() {
+  TEST_ASSERT_EQUAL_INT(2, historyFieldCount(ENCODER));
+  TEST_ASSERT_EQUAL_INT(3, historyFieldCount(ANGLE));
+  TEST_ASSERT_EQUAL_INT(1, historyFieldCount((uint8_t)HistorySensor::ANALOG_2));
+  TEST_ASSERT_EQUAL_INT(0, historyFieldCount((uint8_t)HistorySensor::COUNT));
+}
+
+void test_empty_and_invalid_sensors() {
+  HistorySample sample;
+  HistorySample window[4];
+  uint8_t flags;
+
+  TEST_ASSERT_FALSE(historyQueryAt(ENCODER, 1000, sample, flags));
+  TEST_ASSERT_EQUAL_INT(0, historyQueryWindow(ENCODER, 0, UINT32_MAX / 2, window, 4));
+
+  _record(HistorySensor::ENCODER_0, 1000, 1);
+  TEST_ASSERT_FALSE(historyQueryAt((uint8_t)HistorySensor::COUNT, 1000, sample, flags));
+  TEST_ASSERT_EQUAL_INT(0, historyQueryWindow(0xFF, 0, 2000, window, 4));
+}
+
+void test_record_drops_samples_that_are_not_newer() {
+  _record(HistorySensor::ENCODER_0, 1000, 1);
+  _record(HistorySensor::ENCODER_0, 1000, 2); // Same sample again
+  _record(HistorySensor::ENCODER_0, 900, 3);  // Older
+  _record(HistorySensor::ENCODER_0, 1100, 4);
+
+  HistorySample window[4];
+  TEST_ASSERT_EQUAL_INT(2, historyQueryWindow(ENCODER, 0, 2000, window, 4));
+  TEST_ASSERT_EQUAL_FLOAT(1, window[0].values[0].f);
+  TEST_ASSERT_EQUAL_FLOAT(4, window[1].values[0].f);
+}
+
+void test_record_due() {
+  TEST_ASSERT_TRUE(historyRecordDue(HistorySensor::ENCODER_0, 0));
+
+  _record(HistorySensor::ENCODER_0, 5000, 1);
+  TEST_ASSERT_FALSE(historyRecordDue(HistorySensor::ENCODER_0, 5000 + HISTORY_RECORD_PERIOD_US - 1));
+  TEST_ASSERT_TRUE(historyRecordDue(HistorySensor::ENCODER_0, 5000 + HISTORY_RECORD_PERIOD_US));
+
+  // Each sensor has its own period
+  TEST_ASSERT_TRUE(historyRecordDue(HistorySensor::ACCEL, 5001));
+}
+
+// ===============================
+// Point queries
+// ===============================
+
+void test_query_exact() {
+  _recordRun(1000, 0, 5);
+
+  for (int i = 0; i < 5; i++) {
+    HistorySample sample;
+    uint8_t flags;
+    uint32_t t = 1000 + i * HISTORY_RECORD_PERIOD_US;
+    TEST_ASSERT_TRUE(historyQueryAt(ENCODER, t, sample, flags));
+    TEST_ASSERT_EQUAL_UINT8(HISTORY_FLAG_EXACT, flags);
+    TEST_ASSERT_EQUAL_UINT32(t, sample.timeUs);
+    TEST_ASSERT_EQUAL_FLOAT(i, sample.values[0].f);
+    TEST_ASSERT_EQUAL_FLOAT(-i, sample.values[1].f);
+  }
+}
+
+void test_query_interpolates() {
+  _record(HistorySensor::ACCEL, 1000, 0, 100, -1);
+  _record(HistorySensor::ACCEL, 11000, 10, 50, 1);
+  _record(HistorySensor::ACCEL, 21000, 30, 50, 1);
+
+  HistorySample sample;
+  uint8_t flags;
+
+  TEST_ASSERT_TRUE(historyQueryAt(ACCEL_SENSOR, 3500, sample, flags));
+  TEST_ASSERT_EQUAL_UINT8(HISTORY_FLAG_INTERPOLATED, flags);
+  TEST_ASSERT_EQUAL_UINT32(3500, sample.timeUs);
+  TEST_ASSERT_FLOAT_WITHIN(1e-4f, 2.5f, sample.values[0].f);
+  TEST_ASSERT_FLOAT_WITHIN(1e-4f, 87.5f, sample.values[1].f);
+  TEST_ASSERT_FLOAT_WITHIN(1e-4f, -0.5f, sample.values[2].f);
+
+  TEST_ASSERT_TRUE(historyQueryAt(ACCEL_SENSOR, 16000, sample, flags));
+  TEST_ASSERT_EQUAL_UINT8(HISTORY_FLAG_INTERPOLATED, flags);
+  TEST_ASSERT_FLOAT_WITHIN(1e-4f, 20.0f, sample.values[0].f);
+  TEST_ASSERT_FLOAT_WITHIN(1e-4f, 50.0f, sample.values[1].f);
+}
+
+static void _recordEncoder(uint32_t timeUs, int count, uint32_t period) {
+  HistoryValue values[2];
+  values[0].f = (float)count;
+  values[1].u = period;
+  historyRecord(HistorySensor::ENCODER_0, timeUs, values);
+}
+
+void test_encoder_period_is_not_blended() {
+  // Stopped, then moving forward, then moving backward. The period is the
+  // raw value with the direction in bit 0
+  const uint32_t forward = (9000 << 1);
+  const uint32_t backward = (70000000u << 1) | 1; // More than a float holds exactly
+  _recordEncoder(0, 0, UINT32_MAX);
+  _recordEncoder(10000, 100, forward);
+  _recordEncoder(20000, 50, backward);
+
+  HistorySample sample;
+  uint8_t flags;
+
+  // The count is interpolated, the period comes from the nearer sample
+  TEST_ASSERT_TRUE(historyQueryAt(ENCODER, 4000, sample, flags));
+  TEST_ASSERT_EQUAL_UINT8(HISTORY_FLAG_INTERPOLATED, flags);
+  TEST_ASSERT_FLOAT_WITHIN(1e-4f, 40.0f, sample.values[0].f);
+  TEST_ASSERT_EQUAL_UINT32(UINT32_MAX, sample.values[1].u);
+
+  TEST_ASSERT_TRUE(historyQueryAt(ENCODER, 6000, sample, flags));
+  TEST_ASSERT_EQUAL_UINT32(forward, sample.values[1].u);
+
+  TEST_ASSERT_TRUE(historyQueryAt(ENCODER, 17500, sample, flags));
+  TEST_ASSERT_FLOAT_WITHIN(1e-4f, 62.5f, sample.values[0].f);
+  TEST_ASSERT_EQUAL_UINT32(backward, sample.values[1].u);
+
+  // Kept exactly in windows and exact answers too
+  HistorySample window[4];
+  TEST_ASSERT_EQUAL_INT(3, historyQueryWindow(ENCODER, 0, 20000, window, 4));
+  TEST_ASSERT_EQUAL_UINT32(UINT32_MAX, window[0].values[1].u);
+  TEST_ASSERT_EQUAL_UINT32(backward, window[2].values[1].u);
+}
+
+void test_query_clamps_outside_history() {
+  _recordRun(100000, 0, 3);
+
+  HistorySample sample;
+  uint8_t flags;
+
+  TEST_ASSERT_TRUE(historyQueryAt(ENCODER, 99999, sample, flags));
+  TEST_ASSERT_EQUAL_UINT8(HISTORY_FLAG_CLAMPED, flags);
+  TEST_ASSERT_EQUAL_UINT32(100000, sample.timeUs);
+  TEST_ASSERT_EQUAL_FLOAT(0, sample.values[0].f);
+
+  TEST_ASSERT_TRUE(historyQueryAt(ENCODER, 200000, sample, flags));
+  TEST_ASSERT_EQUAL_UINT8(HISTORY_FLAG_CLAMPED, flags);
+  TEST_ASSERT_EQUAL_UINT32(100000 + 2 * HISTORY_RECORD_PERIOD_US, sample.timeUs);
+  TEST_ASSERT_EQUAL_FLOAT(2, sample.values[0].f);
+}
+
+void test_query_clamps_to_oldest_kept_sample() {
+  // Overwrite the ring one and a half times
+  _recordRun(0, 0, HISTORY_LENGTH + HISTORY_LENGTH / 2);
+
+  HistorySample sample;
+  uint8_t flags;
+  TEST_ASSERT_TRUE(historyQueryAt(ENCODER, 0, sample, flags));
+  TEST_ASSERT_EQUAL_UINT8(HISTORY_FLAG_CLAMPED, flags);
+  TEST_ASSERT_EQUAL_FLOAT(HISTORY_LENGTH / 2, sample.values[0].f);
+}
+
+void test_query_across_timer_wrap() {
+  uint32_t start = UINT32_MAX - 15000;
+  _record(HistorySensor::ENCODER_0, start, 0);
+  _record(HistorySensor::ENCODER_0, start + 10000, 10);
+  _record(HistorySensor::ENCODER_0, start + 20000, 20); // Past the wrap
+
+  HistorySample sample;
+  uint8_t flags;
+  TEST_ASSERT_TRUE(historyQueryAt(ENCODER, start + 15000, sample, flags));
+  TEST_ASSERT_EQUAL_UINT8(HISTORY_FLAG_INTERPOLATED, flags);
+  TEST_ASSERT_FLOAT_WITHIN(1e-4f, 15.0f, sample.values[0].f);
+
+  HistorySample window[4];
+  TEST_ASSERT_EQUAL_INT(2, historyQueryWindow(ENCODER, start + 5000, start + 25000, window, 4));
+  TEST_ASSERT_EQUAL_FLOAT(10, window[0].values[0].f);
+  TEST_ASSERT_EQUAL_FLOAT(20, window[1].values[0].f);
+}
+
+void test_yaw_interpolates_the_short_way() {
+  // Roll, pitch, yaw
+  _record(HistorySensor::GYRO_ANGLE, 0, 350, -10, 350);
+  _record(HistorySensor::GYRO_ANGLE, 10000, 10, 10, 10);
+
+  HistorySample sample;
+  uint8_t flags;
+
+  TEST_ASSERT_TRUE(historyQueryAt(ANGLE, 2500, sample, flags));
+  TEST_ASSERT_FLOAT_WITHIN(1e-3f, 355.0f, sample.values[2].f);
+
+  // Only yaw wraps
+  TEST_ASSERT_FLOAT_WITHIN(1e-3f, 265.0f, sample.values[0].f);
+  TEST_ASSERT_FLOAT_WITHIN(1e-3f, -5.0f, sample.values[1].f);
+}
+
+void test_yaw_keeps_the_range_of_the_samples() {
+  // The live yaw has the reset offset taken off, so it goes negative when the
+  // robot turns one way after a reset
+  _record(HistorySensor::GYRO_ANGLE, 0, 0, 0, -9);
+  _record(HistorySensor::GYRO_ANGLE, 10000, 0, 0, -11);
+  _record(HistorySensor::GYRO_ANGLE, 20000, 0, 0, -13);
+
+  HistorySample sample;
+  uint8_t flags;
+
+  // Interpolated, exact and clamped answers all agree on the same heading
+  TEST_ASSERT_TRUE(historyQueryAt(ANGLE, 5000, sample, flags));
+  TEST_ASSERT_EQUAL_UINT8(HISTORY_FLAG_INTERPOLATED, flags);
+  TEST_ASSERT_FLOAT_WITHIN(1e-3f, -10.0f, sample.values[2].f);
+
+  TEST_ASSERT_TRUE(historyQueryAt(ANGLE, 10000, sample, flags));
+  TEST_ASSERT_EQUAL_UINT8(HISTORY_FLAG_EXACT, flags);
+  TEST_ASSERT_FLOAT_WITHIN(1e-3f, -11.0f, sample.values[2].f);
+
+  TEST_ASSERT_TRUE(historyQueryAt(ANGLE, 30000, sample, flags));
+  TEST_ASSERT_EQUAL_UINT8(HISTORY_FLAG_CLAMPED, flags);
+  TEST_ASSERT_FLOAT_WITHIN(1e-3f, -13.0f, sample.values[2].f);
+
+  // Where the stored yaw jumps by 360 (-350 is 10), the answer carries on the
+  // short way from the earlier sample
+  _record(HistorySensor::GYRO_ANGLE, 30000, 0, 0, -350);
+  TEST_ASSERT_TRUE(historyQueryAt(ANGLE, 27500, sample, flags));
+  TEST_ASSERT_FLOAT_WITHIN(1e-3f, -13.0f + 0.75f * 23.0f, sample.values[2].f);
+}
+
+// ===============================
+// Windows
+// ===============================
+
+void test_window_is_inclusive_and_oldest_first() {
+  _recordRun(0, 0, 10);
+
+  HistorySample window[16];
+  int n = historyQueryWindow(ENCODER, 2 * HISTORY_RECORD_PERIOD_US, 5 * HISTORY_RECORD_PERIOD_US, window, 16);
+  TEST_ASSERT_EQUAL_INT(4, n);
+  for (int i = 0; i < n; i++) {
+    TEST_ASSERT_EQUAL_FLOAT(2 + i, window[i].values[0].f);
+  }
+
+  // Exclusive start leaves out the sample at startUs
+  n = historyQueryWindow(ENCODER, 2 * HISTORY_RECORD_PERIOD_US, 5 * HISTORY_RECORD_PERIOD_US, window, 16, true);
+  TEST_ASSERT_EQUAL_INT(3, n);
+  TEST_ASSERT_EQUAL_FLOAT(3, window[0].values[0].f);
+
+  // Limited to maxSamples, from the oldest
+  n = historyQueryWindow(ENCODER, 0, 9 * HISTORY_RECORD_PERIOD_US, window, 3);
+  TEST_ASSERT_EQUAL_INT(3, n);
+  TEST_ASSERT_EQUAL_FLOAT(0, window[0].values[0].f);
+  TEST_ASSERT_EQUAL_FLOAT(2, window[2].values[0].f);
+}
+
+// Pages the way writeHistoryResponses() does, by the time of the last sample sent
+static int _pageWindow(uint32_t startUs, uint32_t endUs, int pageSize, int recordPerPage,
+                       int &nextRecord, float *sent, int maxSent) {
+  int total = 0;
+  bool resumed = false;
+  uint32_t lastSentUs = 0;
+
+  while (true) {
+    HistorySample page[8];
+    int n = historyQueryWindow(ENCODER, resumed ? lastSentUs : startUs, endUs, page, pageSize, resumed);
+    if (n == 0) break;
+
+    for (int i = 0; i < n && total < maxSent; i++) {
+      sent[total++] = page[i].values[0].f;
+    }
+    resumed = true;
+    lastSentUs = page[n - 1].timeUs;
+
+    // New samples arrive between frames, and push the oldest ones out
+    _recordRun(0, nextRecord, recordPerPage);
+    nextRecord += recordPerPage;
+  }
+  return total;
+}
+
+void test_window_paging() {
+  _recordRun(0, 0, 40);
+
+  float sent[64];
+  int next = 40;
+  int total = _pageWindow(5 * HISTORY_RECORD_PERIOD_US, 30 * HISTORY_RECORD_PERIOD_US, 8, 0, next, sent, 64);
+
+  // Every sample in the window once, in order
+  TEST_ASSERT_EQUAL_INT(26, total);
+  for (int i = 0; i < total; i++) {
+    TEST_ASSERT_EQUAL_FLOAT(5 + i, sent[i]);
+  }
+}
+
+void test_window_paging_while_the_ring_fills() {
+  _recordRun(0, 0, HISTORY_LENGTH);
+
+  // Ten new samples per page, so the ring drops the oldest ones while the
+  // window is being sent. No sample can be sent twice or out of order, and
+  // the only ones missing are the ones that were evicted before they were sent
+  float sent[HISTORY_LENGTH];
+  int next = HISTORY_LENGTH;
+  uint32_t endUs = (HISTORY_LENGTH - 1) * HISTORY_RECORD_PERIOD_US;
+  int total = _pageWindow(0, endUs, 8, 10, next, sent, HISTORY_LENGTH);
+
+  TEST_ASSERT_GREATER_THAN(0, total);
+  TEST_ASSERT_EQUAL_FLOAT(HISTORY_LENGTH - 1, sent[total - 1]);
+  for (int i = 1; i < total; i++) {
+    TEST_ASSERT_TRUE(sent[i] > sent[i - 1]);
+
+    // Gaps only where the ring overtook the page
+    if (sent[i] != sent[i - 1] + 1) {
+      TEST_ASSERT_TRUE(sent[i] - sent[i - 1] <= 10);
+    }
+  }
+
+  // Eviction never restarts the window from a sample that was already sent
+  TEST_ASSERT_LESS_OR_EQUAL(HISTORY_LENGTH, total);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_field_counts);
+  RUN_TEST(test_empty_and_invalid_sensors);
+  RUN_TEST(test_record_drops_samples_that_are_not_newer);
+  RUN_TEST(test_record_due);
+  RUN_TEST(test_query_exact);
+  RUN_TEST(test_query_interpolates);
+  RUN_TEST(test_encoder_period_is_not_blended);
+  RUN_TEST(test_query_clamps_outside_history);
+  RUN_TEST(test_query_clamps_to_oldest_kept_sample);
+  RUN_TEST(test_query_across_timer_wrap);
+  RUN_TEST(test_yaw_interpolates_the_short_way);
+  RUN_TEST(test_yaw_keeps_the_range_of_the_samples);
+  RUN_TEST(test_window_is_inclusive_and_oldest_first);
+  RUN_TEST(test_window_paging);
+  RUN_TEST(test_window_paging_while_the_ring_fills);
+  return UNITY_END();
+}